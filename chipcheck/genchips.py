@@ -0,0 +1,347 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2013 Chris McClelland
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; version 2 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+#
+"""Generate common/flash_chip_table.inc, the const FlashChip table.
+
+The table is the hand-maintained entries of gordon_chips.def, plus (given
+--flashrom) the plain SPI NOR parts from flashrom's flashchips.c which
+gordon's generic functions can drive: those probed by JEDEC ID, with 3-byte
+addresses, programmed 256 bytes at a time and erased with 0xD8 or 0x20.
+Hand-maintained entries win over imported ones with the same key.
+
+The table is indexed with a minimal perfect hash of (vendorID, deviceID,
+variant), whose per-bucket seeds are found here and emitted with the table,
+so lookups need no index to be built at run time. The hash must match
+chipHash() in flash_chips.cpp.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+MASK32 = 0xFFFFFFFF
+NUM_ERASEREGIONS = 5
+MAX_PAGESIZE = 528
+NO_SELECTOR = "nullSelector"
+
+# flashrom functions, and the gordon functions which do the same job
+ERASERS = [("spi_block_erase_d8", "spiBlockEraseD8"), ("spi_block_erase_20", "spiBlockErase20")]
+WRITERS = {"spi_chip_write_256": "spiPageProgram02", "spi_chip_write256": "spiPageProgram02"}
+READERS = {"spi_chip_read": "spiRead03"}
+PROBES = ("probe_spi_rdid", "probe_spi_rdid4")
+GENERIC_IDS = ("GENERIC_DEVICE_ID", "SFDP_DEVICE_ID", "GENERIC_MANUF_ID")
+
+
+def chip_hash(vendor_id, device_id, variant, seed):
+	"""As chipHash() in flash_chips.cpp."""
+	h = ((vendor_id ^ seed) * 0x9E3779B1) & MASK32
+	h = ((h ^ device_id) * 0x85EBCA77) & MASK32
+	h = ((h ^ variant) * 0xC2B2AE3D) & MASK32
+	return h ^ (h >> 16)
+
+
+def fnv1a(data):
+	"""As the source hash computed by chipcheck."""
+	h = 0x811C9DC5
+	for byte in data:
+		h = ((h ^ byte) * 0x01000193) & MASK32
+	return h
+
+
+def strip_comments(text):
+	"""Remove C comments, leaving string literals alone."""
+	return re.sub(r'//[^\n]*|/\*.*?\*/|("(?:\\.|[^"\\])*")', lambda m: m.group(1) or " ", text, flags=re.S)
+
+
+def read_defines(text):
+	defines = {}
+	for name, value in re.findall(r'^\s*#define\s+(\w+)\s+(0[xX][0-9A-Fa-f]+|\d+)\b', text, re.M):
+		defines[name] = int(value, 0)
+	return defines
+
+
+def spans(text, start):
+	"""Split the brace-enclosed list whose "{" is at text[start] into the
+	spans of its top-level items, each from its "{" to its "}"."""
+	items, depth, begin, i = [], 0, None, start
+	while True:
+		ch = text[i]
+		if ch == '"':
+			i += 1
+			while text[i] != '"':
+				i += 2 if text[i] == "\\" else 1
+		elif ch == "{":
+			depth += 1
+			if depth == 2:
+				begin = i
+		elif ch == "}":
+			depth -= 1
+			if depth == 1:
+				items.append((begin, i + 1))
+			elif depth == 0:
+				return items
+		i += 1
+
+
+def fields(body):
+	"""Split the inside of an initialiser into its top-level fields."""
+	result, depth, current, in_string = [], 0, "", False
+	for i, ch in enumerate(body):
+		if in_string:
+			in_string = not (ch == '"' and body[i - 1] != "\\")
+		elif ch == '"':
+			in_string = True
+		elif ch == "{":
+			depth += 1
+		elif ch == "}":
+			depth -= 1
+		elif ch == "," and depth == 0:
+			result.append(current.strip())
+			current = ""
+			continue
+		current += ch
+	if current.strip():
+		result.append(current.strip())
+	return result
+
+
+def evaluate(expr, defines):
+	expr = expr.strip()
+	if expr in defines:
+		return defines[expr]
+	if not re.fullmatch(r'[0-9xXa-fA-F\s*+()]+', expr):
+		raise ValueError("cannot evaluate %r" % expr)
+	return int(eval(expr, {"__builtins__": {}}))
+
+
+class Chip:
+	def __init__(self, key, text, vendor_name, device_name):
+		self.key = key
+		self.text = text
+		self.vendor_name = vendor_name
+		self.device_name = device_name
+
+
+def load_gordon(path):
+	with open(path, "rb") as f:
+		raw = f.read()
+	text = raw.decode("utf-8")
+	clean = strip_comments(text)
+	defines = read_defines(clean)
+	table = re.search(r'gordonChips\[\]\s*=\s*\{', text)
+	if not table:
+		sys.exit("%s: no gordonChips[] table" % path)
+	defines_text = text[:table.start()]
+	defines_text = defines_text[defines_text.find("#define"):]
+	defines_text = defines_text[:defines_text.rfind("\n") + 1].rstrip("\n") + "\n"
+	chips = []
+	for begin, end in spans(text, table.end() - 1):
+		item = fields(strip_comments(text[begin + 1:end - 1]))
+		key = (evaluate(item[2], defines), evaluate(item[3], defines), evaluate(item[4], defines))
+		chips.append(Chip(key, text[begin:end], item[0].strip('"'), item[1].strip('"')))
+	return raw, defines, defines_text, chips
+
+
+def load_flashrom(directory, defines):
+	"""The flashrom parts gordon can drive, as Chips, and the #defines of the
+	IDs they use."""
+	with open(os.path.join(directory, "flashchips.h")) as f:
+		flashrom_defines = read_defines(strip_comments(f.read()))
+	with open(os.path.join(directory, "flashchips.c")) as f:
+		text = strip_comments(f.read())
+	table = re.search(r'flashchips\[\]\s*=\s*\{', text)
+	if not table:
+		sys.exit("%s: no flashchips[] table" % directory)
+	chips, used, skipped = [], {}, 0
+	for begin, end in spans(text, table.end() - 1):
+		entry = {}
+		for item in fields(text[begin + 1:end - 1]):
+			m = re.match(r'\.(\w+)\s*=\s*(.*)', item, re.S)
+			if m:
+				entry[m.group(1)] = m.group(2).strip()
+		chip = convert(entry, flashrom_defines)
+		if not chip:
+			skipped += 1
+			continue
+		for name in (entry["manufacture_id"], entry["model_id"]):
+			value = flashrom_defines[name]
+			if defines.get(name, value) != value:
+				sys.exit("flashrom defines %s as 0x%X, but gordon_chips.def as 0x%X" % (name, value, defines[name]))
+			used[name] = value
+		chips.append(chip)
+	sys.stderr.write("flashrom: %u parts gordon can drive, %u skipped\n" % (len(chips), skipped))
+	return chips, used
+
+
+def convert(entry, defines):
+	"""A Chip for one flashrom entry, or None if gordon cannot drive it."""
+	try:
+		entry = dict((k, v.lower() if k in ("probe", "write", "read") else v) for k, v in entry.items())
+		if "BUS_SPI" not in entry.get("bustype", "") or entry.get("probe") not in PROBES:
+			return None
+		vendor, model = entry["manufacture_id"], entry["model_id"]
+		if vendor in GENERIC_IDS or model in GENERIC_IDS or vendor not in defines or model not in defines:
+			return None
+		write, read = WRITERS.get(entry.get("write")), READERS.get(entry.get("read"))
+		kb, page = evaluate(entry["total_size"], defines), evaluate(entry.get("page_size", "0"), defines)
+		if not write or not read or kb > 16384 or page != 256:
+			return None
+		erasers = {}
+		for begin, end in spans(entry["block_erasers"], 0):
+			eraser = {}
+			for item in fields(entry["block_erasers"][begin + 1:end - 1]):
+				m = re.match(r'\.(\w+)\s*=\s*(.*)', item, re.S)
+				if m:
+					eraser[m.group(1)] = m.group(2).strip()
+			if "eraseblocks" in eraser and "block_erase" in eraser:
+				erasers[eraser["block_erase"].lower()] = eraser["eraseblocks"]
+		for flashrom_func, gordon_func in ERASERS:
+			if flashrom_func in erasers:
+				erase, blocks = gordon_func, erasers[flashrom_func]
+				break
+		else:
+			return None
+		regions = []
+		block_list = blocks.strip()
+		for begin, end in spans(block_list, 0):
+			size, count = [evaluate(x, defines) for x in fields(block_list[begin + 1:end - 1])]
+			if regions and regions[-1][0] == size:
+				regions[-1][1] += count
+			else:
+				regions.append([size, count])
+		if len(regions) > NUM_ERASEREGIONS or sum(s * c for s, c in regions) != 1024 * kb:
+			return None
+	except (KeyError, ValueError):
+		return None
+	vendor_name = entry["vendor"].strip('"')
+	device_name = entry["name"].strip('"')
+	lines = [
+		"{",
+		'\t\t"%s",' % vendor_name,
+		'\t\t"%s",' % device_name,
+		"\t\t%s," % vendor,
+		"\t\t%s," % model,
+		"\t\t0,  // variant",
+		"\t\t%u,  // device size in KiB" % kb,
+		"\t\t%u,  // page size in bytes" % page,
+		"\t\t8,",
+		"\t\t{",
+		"\n".join("\t\t\t{%s, %u}," % (size_text(s), c) for s, c in regions),
+		"\t\t},",
+		"\t\t%s," % erase,
+		"\t\t%s," % write,
+		"\t\t%s," % read,
+		"\t\t%s," % NO_SELECTOR,
+		"\t\tNULL,", "\t\tNULL,", "\t\tNULL,", "\t\tNULL,",
+		"\t\t0,", "\t\t0,",
+		"\t\tNULL,", "\t\tNULL,", "\t\tNULL,",
+		"\t\tNULL",
+		"\t}",
+	]
+	return Chip((defines[vendor], defines[model], 0), "\n".join(lines), vendor_name, device_name)
+
+
+def size_text(size):
+	return "%u * 1024" % (size // 1024) if size % 1024 == 0 else "%u" % size
+
+
+def perfect_hash(keys):
+	"""Per-bucket seeds, and the table index in each slot, such that key k is
+	in slot chip_hash(k, seeds[chip_hash(k, 0) % len(seeds)]) % len(keys)."""
+	n = len(keys)
+	num_buckets = max(1, (n + 3) // 4)
+	while True:
+		buckets = [[] for _ in range(num_buckets)]
+		for index, key in enumerate(keys):
+			buckets[chip_hash(key[0], key[1], key[2], 0) % num_buckets].append(index)
+		seeds, slots = [0] * num_buckets, [None] * n
+		for bucket in sorted(range(num_buckets), key=lambda b: -len(buckets[b])):
+			if not buckets[bucket]:
+				continue
+			for seed in range(1, 0x10000):
+				wanted = [chip_hash(keys[i][0], keys[i][1], keys[i][2], seed) % n for i in buckets[bucket]]
+				if len(set(wanted)) == len(wanted) and all(slots[s] is None for s in wanted):
+					for i, s in zip(buckets[bucket], wanted):
+						slots[s] = i
+					seeds[bucket] = seed
+					break
+			else:
+				break
+		else:
+			return seeds, slots
+		num_buckets += 1
+
+
+def c_list(values):
+	lines, line = [], "\t"
+	for value in values:
+		item = "%u, " % value
+		if len(line) + len(item) > 80:
+			lines.append(line.rstrip())
+			line = "\t"
+		line += item
+	lines.append(line.rstrip().rstrip(","))
+	return "\n".join(lines)
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+	parser.add_argument("gordon", help="the hand-maintained entries (gordon_chips.def)")
+	parser.add_argument("-o", "--output", required=True, help="the table to write")
+	parser.add_argument("--flashrom", help="a flashrom source tree, to import parts from")
+	args = parser.parse_args()
+
+	raw, defines, defines_text, chips = load_gordon(args.gordon)
+	keys = set()
+	for chip in chips:
+		if chip.key in keys:
+			sys.exit("%s: duplicate entry for %s %s" % (args.gordon, chip.vendor_name, chip.device_name))
+		keys.add(chip.key)
+	imported, imported_defines = [], {}
+	if args.flashrom:
+		candidates, imported_defines = load_flashrom(args.flashrom, defines)
+		local = set(keys)
+		for chip in candidates:
+			if chip.key not in keys:
+				keys.add(chip.key)
+				imported.append(chip)
+			elif chip.key not in local:
+				sys.stderr.write("flashrom: skipping %s %s, which has the same IDs as an earlier part\n" % (chip.vendor_name, chip.device_name))
+		sys.stderr.write("flashrom: %u parts imported\n" % len(imported))
+	all_chips = chips + imported
+	seeds, slots = perfect_hash([chip.key for chip in all_chips])
+
+	with open(args.output, "w") as out:
+		out.write("// Generated by chipcheck/genchips.py from chipcheck/gordon_chips.def")
+		out.write(" and flashrom.\n" if imported else ".\n")
+		out.write("// Do not edit; change the inputs and run \"make table\" in chipcheck.\n//\n")
+		out.write("#define CHIP_TABLE_SOURCE 0x%08XU\n\n" % fnv1a(raw))
+		out.write(defines_text)
+		for name in sorted(set(imported_defines) - set(defines)):
+			out.write("#define %s 0x%X\n" % (name, imported_defines[name]))
+		out.write("\nstatic const FlashChip flashChips[] = {\n\t")
+		out.write(", ".join(chip.text for chip in all_chips))
+		out.write("\n};\n\n")
+		out.write("#define NUM_CHIPS %u\n" % len(all_chips))
+		out.write("#define NUM_CHIP_BUCKETS %u\n\n" % len(seeds))
+		out.write("static const uint16 chipSeeds[NUM_CHIP_BUCKETS] = {\n%s\n};\n\n" % c_list(seeds))
+		out.write("static const uint16 chipSlots[NUM_CHIPS] = {\n%s\n};\n" % c_list(slots))
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,56 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstdio>
+#include "flash_chips.h"
+#include "exception.h"
+
+// The FNV-1a hash of the file, which genchips.py records in the table it
+// generates from it.
+//
+static uint32 sourceHash(const char *fileName) {
+	uint32 hash = 0x811C9DC5U;
+	int ch;
+	FILE *const file = fopen(fileName, "rb");
+	if ( !file ) {
+		char msg[256];
+		sprintf(msg, "sourceHash(): Unable to open %.128s!", fileName);
+		throw GordonException(msg);
+	}
+	while ( (ch = fgetc(file)) != EOF ) {
+		hash = (hash ^ (uint32)ch) * 0x01000193U;
+	}
+	fclose(file);
+	return hash;
+}
+
+// Run as part of the build, so a bad or stale FlashChip table fails the build
+// rather than every session in the field.
+//
+int main(int argc, const char *argv[]) {
+	if ( argc != 2 ) {
+		fprintf(stderr, "Synopsis: %s <gordon_chips.def>\n", argv[0]);
+		return 1;
+	}
+	try {
+		checkChipTable(sourceHash(argv[1]));
+	}
+	catch ( GordonException &ex ) {
+		fprintf(stderr, "%s\n", ex.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,66 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include "bitstream.h"
+
+// A Xilinx .bit file starts with this field, then a field of keyed strings (the
+// design name, part, date and time, keyed 'a' to 'd'), each with a two-byte
+// length, then the key 'e' and the four-byte length of the configuration data
+// which follows. All lengths are big-endian.
+//
+static const uint8 bitHeader[] = {
+	0x00, 0x09, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x0F, 0xF0, 0x00, 0x00, 0x01
+};
+
+static uint64 xilinxLength(const uint8 *data, uint64 length) {
+	uint64 offset = sizeof(bitHeader);
+	uint32 i;
+	if ( length < offset ) {
+		return length;
+	}
+	for ( i = 0; i < sizeof(bitHeader); i++ ) {
+		if ( data[i] != bitHeader[i] ) {
+			return length;
+		}
+	}
+	while ( offset < length ) {
+		const uint8 key = data[offset];
+		if ( key == 'e' ) {
+			uint64 dataLength;
+			if ( offset + 5 > length ) {
+				break;
+			}
+			dataLength =
+				((uint32)data[offset + 1] << 24) | ((uint32)data[offset + 2] << 16) |
+				((uint32)data[offset + 3] << 8) | data[offset + 4];
+			offset += 5;
+			return (dataLength < length - offset) ? offset + dataLength : length;
+		}
+		if ( key < 'a' || key > 'd' || offset + 3 > length ) {
+			break;
+		}
+		offset += 3 + (((uint32)data[offset + 1] << 8) | data[offset + 2]);
+	}
+	return length;
+}
+
+uint64 bitstreamLength(const uint8 *data, uint64 length) {
+	length = xilinxLength(data, length);
+	while ( length && data[length - 1] == 0xFF ) {
+		length--;
+	}
+	return length;
+}
@@ -0,0 +1,31 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <makestuff.h>
+
+// The length of the part of a bitstream file which matters, ignoring any
+// padding after it. Xilinx .bit files give the length of their configuration
+// data in their header, so anything after it is padding. Whatever the file,
+// any 0xFF bytes left at the end are taken to be padding too, so this also
+// suits raw bitstreams (e.g iCE40 and Xilinx .bin files) padded to the size of
+// the flash.
+//
+uint64 bitstreamLength(const uint8 *data, uint64 length);
+
+#endif
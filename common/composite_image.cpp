@@ -0,0 +1,114 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstdio>
+#include <cstring>
+#include "exception.h"
+#include "flash_chips.h"
+#include "composite_image.h"
+
+using namespace std;
+
+CompositeImage::CompositeImage(const FlashChip *flashChip) :
+	m_blockMap(flashChip)
+{ }
+
+void CompositeImage::add(const char *name, uint64 address, const uint8 *data, uint64 length) {
+	list<Segment>::iterator it;
+	const Segment *other = NULL;
+	if ( !length ) {
+		return;
+	}
+	if ( length > m_blockMap.capacity() || address > m_blockMap.capacity() - length ) {
+		char msg[256];
+		sprintf(
+			msg,
+			"CompositeImage::add(): %.128s does not fit on the device, whose capacity is 0x%08llX bytes!",
+			name, (unsigned long long)m_blockMap.capacity()
+		);
+		throw GordonException(msg);
+	}
+	for ( it = m_segments.begin(); it != m_segments.end() && it->address < address; ++it );
+	if ( it != m_segments.end() && it->address < address + length ) {
+		other = &*it;
+	} else if ( it != m_segments.begin() ) {
+		list<Segment>::const_iterator prev = it;
+		--prev;
+		if ( prev->address + prev->data.size() > address ) {
+			other = &*prev;
+		}
+	}
+	if ( other ) {
+		char msg[512];
+		sprintf(
+			msg, "CompositeImage::add(): %.128s at 0x%08llX-0x%08llX overlaps %.128s at 0x%08llX-0x%08llX!",
+			name, (unsigned long long)address, (unsigned long long)(address + length - 1),
+			other->name.c_str(), (unsigned long long)other->address,
+			(unsigned long long)(other->address + other->data.size() - 1)
+		);
+		throw GordonException(msg);
+	}
+	it = m_segments.insert(it, Segment());
+	it->name = name;
+	it->address = address;
+	it->data.assign(data, data + length);
+	merge();
+}
+
+uint64 CompositeImage::numRegions(uint64 address, uint64 length) const {
+	const uint64 capacity = m_blockMap.capacity();
+	if ( address >= capacity ) {
+		return 0;
+	}
+	const uint64 end = (length > capacity - address) ? capacity : address + length;
+	if ( address >= end ) {
+		return 0;
+	}
+	return m_blockMap.blockIndex(end - 1) - m_blockMap.blockIndex(address) + 1;
+}
+
+// Rebuild the runs: a file joins the run before it if it starts where that run
+// ends, or in the same region as the run's last byte.
+void CompositeImage::merge() {
+	list<Segment>::const_iterator it = m_segments.begin(), first, next;
+	m_runs.clear();
+	m_merged.clear();
+	while ( it != m_segments.end() ) {
+		ImageRun run;
+		uint64 runEnd = it->address + it->data.size();
+		first = it;
+		for ( next = ++it; next != m_segments.end(); ++next ) {
+			if ( next->address != runEnd && m_blockMap.blockIndex(next->address) != m_blockMap.blockIndex(runEnd - 1) ) {
+				break;
+			}
+			runEnd = next->address + next->data.size();
+		}
+		run.address = first->address;
+		run.length = runEnd - first->address;
+		if ( next == it ) {
+			run.data = &first->data[0];
+		} else {
+			vector<uint8> &buffer = *m_merged.insert(m_merged.end(), vector<uint8>());
+			buffer.assign((size_t)run.length, 0xFF);
+			for ( ; first != next; ++first ) {
+				memcpy(&buffer[(size_t)(first->address - run.address)], &first->data[0], first->data.size());
+			}
+			run.data = &buffer[0];
+		}
+		m_runs.push_back(run);
+		it = next;
+	}
+}
@@ -0,0 +1,67 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef COMPOSITE_IMAGE_H
+#define COMPOSITE_IMAGE_H
+
+#include <list>
+#include <string>
+#include <vector>
+#include "erase_block_map.h"
+
+// A run of contiguous data to be written at a flash byte-address.
+//
+struct ImageRun {
+	uint64 address;
+	uint64 length;
+	const uint8 *data;
+};
+
+// A CompositeImage is several files to be written to one chip together (e.g a
+// bootloader, two bitstreams and a configuration blob), merged into runs of
+// contiguous data. Files which share an erase region go in the same run, with
+// 0xFF filling any gap between them, so each region is erased just once. Files
+// which do not are kept in separate runs, so the regions between them are left
+// alone. Files which overlap one another are rejected.
+//
+class CompositeImage {
+	struct Segment {
+		std::string name;
+		uint64 address;
+		std::vector<uint8> data;
+	};
+	const EraseBlockMap m_blockMap;
+	std::list<Segment> m_segments;          // in address order
+	std::list< std::vector<uint8> > m_merged;  // the data of runs of several files
+	std::vector<ImageRun> m_runs;
+	void merge();
+public:
+	explicit CompositeImage(const FlashChip *flashChip);
+
+	// Add a copy of "length" bytes of data, to be written at "address". The name
+	// is used when reporting a clash with another file.
+	void add(const char *name, uint64 address, const uint8 *data, uint64 length);
+
+	// The number of erase regions covering "length" bytes at "address", ignoring
+	// any beyond the end of the chip.
+	uint64 numRegions(uint64 address, uint64 length) const;
+
+	// The number of files added, and the runs to write, in address order.
+	size_t numFiles() const { return m_segments.size(); }
+	const std::vector<ImageRun> &runs() const { return m_runs; }
+};
+
+#endif
@@ -0,0 +1,143 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include "flash_chips.h"
+#include "erase_block_map.h"
+
+EraseBlockMap::EraseBlockMap(const FlashChip *flashChip) : m_capacity(0), m_numBlocks(0) {
+	const uint64 chipCapacity = (uint64)1024 * flashChip->kbCapacity;
+	uint32 i;
+	for ( i = 0; i < NUM_ERASEREGIONS && m_capacity < chipCapacity; i++ ) {
+		const EraseRegions *const regions = &flashChip->eraseRegions[i];
+		Group group;
+		if ( !regions->count || !regions->size ) {
+			continue;
+		}
+		group.address = m_capacity;
+		group.firstIndex = m_numBlocks;
+		group.size = regions->size;
+		group.count = regions->count;
+		if ( (uint64)group.size * group.count > chipCapacity - m_capacity ) {
+			group.count = (uint32)((chipCapacity - m_capacity + group.size - 1) / group.size);
+		}
+		m_groups.push_back(group);
+		m_capacity += (uint64)group.size * group.count;
+		m_numBlocks += group.count;
+	}
+}
+
+// The group containing "address", or the number of groups if it is beyond the
+// end of the chip.
+size_t EraseBlockMap::findGroup(uint64 address) const {
+	size_t low = 0, high = m_groups.size();
+	if ( address >= m_capacity ) {
+		return m_groups.size();
+	}
+	while ( high - low > 1 ) {
+		const size_t mid = (low + high) / 2;
+		if ( m_groups[mid].address <= address ) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+bool EraseBlockMap::find(uint64 address, EraseBlock *block) const {
+	const size_t g = findGroup(address);
+	if ( g == m_groups.size() ) {
+		return false;
+	}
+	block->size = m_groups[g].size;
+	block->address = address - (address - m_groups[g].address) % block->size;
+	return true;
+}
+
+uint64 EraseBlockMap::blockIndex(uint64 address) const {
+	const Group &group = m_groups[findGroup(address)];
+	return group.firstIndex + (address - group.address) / group.size;
+}
+
+EraseBlock EraseBlockMap::block(uint64 index) const {
+	size_t low = 0, high = m_groups.size();
+	EraseBlock result;
+	while ( high - low > 1 ) {
+		const size_t mid = (low + high) / 2;
+		if ( m_groups[mid].firstIndex <= index ) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	result.size = m_groups[low].size;
+	result.address = m_groups[low].address + (index - m_groups[low].firstIndex) * result.size;
+	return result;
+}
+
+EraseBlockMap::const_iterator EraseBlockMap::begin() const {
+	return const_iterator(this, 0, 0);
+}
+
+EraseBlockMap::const_iterator EraseBlockMap::end() const {
+	return const_iterator(this, m_groups.size(), 0);
+}
+
+EraseBlockMap::const_iterator EraseBlockMap::lowerBound(uint64 address) const {
+	const size_t g = findGroup(address);
+	if ( g == m_groups.size() ) {
+		return end();
+	}
+	return const_iterator(this, g, (uint32)((address - m_groups[g].address) / m_groups[g].size));
+}
+
+EraseBlockMap::const_iterator EraseBlockMap::upperBound(uint64 address, uint64 length) const {
+	const_iterator it;
+	if ( !length ) {
+		return lowerBound(address);
+	}
+	it = lowerBound(address + length - 1);
+	return (it == end()) ? it : ++it;
+}
+
+EraseBlockMap::const_iterator::const_iterator(const EraseBlockMap *map, size_t group, uint32 index) :
+	m_map(map), m_group(group), m_index(index)
+{
+	load();
+}
+
+void EraseBlockMap::const_iterator::load() {
+	if ( m_group < m_map->m_groups.size() ) {
+		const Group &group = m_map->m_groups[m_group];
+		m_block.address = group.address + (uint64)m_index * group.size;
+		m_block.size = group.size;
+	}
+}
+
+EraseBlockMap::const_iterator &EraseBlockMap::const_iterator::operator++() {
+	if ( ++m_index == m_map->m_groups[m_group].count ) {
+		m_group++;
+		m_index = 0;
+	}
+	load();
+	return *this;
+}
+
+EraseBlockMap::const_iterator EraseBlockMap::const_iterator::operator++(int) {
+	const const_iterator old = *this;
+	++*this;
+	return old;
+}
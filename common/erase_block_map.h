@@ -0,0 +1,98 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef ERASE_BLOCK_MAP_H
+#define ERASE_BLOCK_MAP_H
+
+#include <vector>
+#include <makestuff.h>
+
+struct FlashChip;
+
+// One erase block (i.e region) of a chip.
+//
+struct EraseBlock {
+	uint64 address;
+	uint32 size;
+};
+
+/**
+ * An index of the erase blocks of a chip, built once from its eraseRegions.
+ * Rather than a table of every block, it keeps a sorted table of the groups of
+ * equal-sized blocks, each with its start address and the index of its first
+ * block, so finding the block containing an address is a binary search over
+ * the groups then a division, and iterating over blocks is just arithmetic,
+ * however many blocks the chip has.
+ */
+class EraseBlockMap {
+	struct Group {
+		uint64 address;     // address of the group's first block
+		uint64 firstIndex;  // index of the group's first block
+		uint32 size;        // size of each block in the group
+		uint32 count;       // number of blocks in the group
+	};
+	std::vector<Group> m_groups;
+	uint64 m_capacity;
+	uint64 m_numBlocks;
+	size_t findGroup(uint64 address) const;
+public:
+	// Forward iterator over blocks, in address order.
+	class const_iterator {
+		const EraseBlockMap *m_map;
+		size_t m_group;
+		uint32 m_index;  // within the group
+		EraseBlock m_block;
+		void load();
+		friend class EraseBlockMap;
+		const_iterator(const EraseBlockMap *map, size_t group, uint32 index);
+	public:
+		const_iterator() : m_map(NULL), m_group(0), m_index(0) { }
+		const EraseBlock &operator*() const { return m_block; }
+		const EraseBlock *operator->() const { return &m_block; }
+		const_iterator &operator++();
+		const_iterator operator++(int);
+		bool operator==(const const_iterator &other) const {
+			return m_group == other.m_group && m_index == other.m_index;
+		}
+		bool operator!=(const const_iterator &other) const { return !(*this == other); }
+	};
+
+	// Construct from a FlashChip. Blocks beyond the chip's capacity are ignored.
+	explicit EraseBlockMap(const FlashChip *flashChip);
+
+	// The end of the last block, and the number of blocks.
+	uint64 capacity() const { return m_capacity; }
+	uint64 numBlocks() const { return m_numBlocks; }
+
+	// Find the block containing "address", returning false if it is beyond the
+	// end of the chip.
+	bool find(uint64 address, EraseBlock *block) const;
+
+	// The index of the block containing "address" (which must be on the chip),
+	// and the block with a given index (which must be less than numBlocks()).
+	uint64 blockIndex(uint64 address) const;
+	EraseBlock block(uint64 index) const;
+
+	// All the blocks, the block containing "address" onwards (or end() if it is
+	// beyond the chip), and the end of the blocks covering "length" bytes from
+	// "address" (so [lowerBound(a), upperBound(a, l)) covers them).
+	const_iterator begin() const;
+	const_iterator end() const;
+	const_iterator lowerBound(uint64 address) const;
+	const_iterator upperBound(uint64 address, uint64 length) const;
+};
+
+#endif
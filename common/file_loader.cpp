@@ -0,0 +1,107 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstdlib>
+#include "exception.h"
+#include "file_loader.h"
+#include "util.h"
+
+#define LOAD_CHUNK 0x10000
+
+FileLoader::FileLoader(const char *fileName, bool swap) :
+	m_fileName(fileName), m_swap(swap), m_file(NULL), m_length(0), m_buffer(NULL),
+	m_loaded(0), m_failed(false), m_cancelled(false), m_thread(NULL)
+{
+	m_file = fopen(fileName, "rb");
+	if ( !m_file ) {
+		throw GordonException("Unable to read from file.");
+	}
+	{
+		// A pipe or FIFO has no length, so ftell() fails
+		long length = -1;
+		if ( fseek(m_file, 0, SEEK_END) == 0 ) {
+			length = ftell(m_file);
+		}
+		if ( length < 0 || fseek(m_file, 0, SEEK_SET) != 0 ) {
+			char msg[256];
+			fclose(m_file);
+			sprintf(msg, "FileLoader::FileLoader(): Unable to find the length of %.128s; it must be a regular file!", fileName);
+			throw GordonException(msg);
+		}
+		m_length = (size_t)length;
+	}
+	m_buffer = (uint8 *)malloc(m_length + 1);
+	if ( m_buffer ) {
+		m_thread = new Thread(run, this);
+		if ( !m_thread->started() ) {
+			delete m_thread;
+			m_thread = NULL;
+		}
+	}
+	if ( !m_thread ) {
+		free(m_buffer);
+		fclose(m_file);
+		throw GordonException("Unable to read from file.");
+	}
+}
+
+FileLoader::~FileLoader() {
+	{
+		LockJanitor lock(m_mutex);
+		m_cancelled = true;
+	}
+	delete m_thread;  // joins it
+	fclose(m_file);
+	free(m_buffer);
+}
+
+void FileLoader::run(void *param) {
+	((FileLoader *)param)->load();
+}
+
+void FileLoader::load() {
+	size_t offset = 0;
+	while ( offset < m_length ) {
+		const size_t chunkLength = (m_length - offset > LOAD_CHUNK) ? LOAD_CHUNK : m_length - offset;
+		const bool ok = (fread(m_buffer + offset, 1, chunkLength, m_file) == chunkLength);
+		if ( ok && m_swap ) {
+			bitSwap(chunkLength, m_buffer + offset);
+		}
+		LockJanitor lock(m_mutex);
+		if ( !ok ) {
+			m_failed = true;
+		} else {
+			offset += chunkLength;
+			m_loaded = offset;
+		}
+		m_progress.broadcast();
+		if ( !ok || m_cancelled ) {
+			return;
+		}
+	}
+}
+
+void FileLoader::waitFor(size_t length) {
+	LockJanitor lock(m_mutex);
+	while ( m_loaded < length && !m_failed ) {
+		m_progress.wait(m_mutex);
+	}
+	if ( m_loaded < length ) {
+		char msg[256];
+		sprintf(msg, "FileLoader::waitFor(): Unable to read %.128s!", m_fileName.c_str());
+		throw GordonException(msg);
+	}
+}
@@ -0,0 +1,64 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef FILE_LOADER_H
+#define FILE_LOADER_H
+
+#include <cstdio>
+#include <string>
+#include <makestuff.h>
+#include "sync.h"
+
+// A FileLoader reads a file into memory on a thread of its own, bit-swapping it
+// if asked to, so the flash can be written whilst the rest of the file is still
+// loading. The buffer is allocated for the whole file up front, and filled in
+// chunks; the loading thread publishes how far it has got after each chunk, and
+// the writing thread waits for the bytes it needs with waitFor().
+//
+class FileLoader {
+	const std::string m_fileName;
+	const bool m_swap;
+	FILE *m_file;
+	size_t m_length;
+	uint8 *m_buffer;
+	Mutex m_mutex;
+	Condition m_progress;
+	size_t m_loaded;
+	bool m_failed;
+	bool m_cancelled;
+	Thread *m_thread;
+	static void run(void *param);
+	void load();
+	FileLoader &operator=(const FileLoader &other);
+	FileLoader(const FileLoader &other);
+public:
+	// Open the file and start loading it, throwing if it cannot be read.
+	FileLoader(const char *fileName, bool swap);
+
+	// Stop loading, if it has not finished, and free the buffer.
+	~FileLoader();
+
+	// The length of the file, and the buffer it is loaded into. Only the bytes
+	// waited for may be used.
+	size_t length() const { return m_length; }
+	const uint8 *data() const { return m_buffer; }
+
+	// Wait until the first "length" bytes have been loaded, throwing if the file
+	// could not be read that far.
+	void waitFor(size_t length);
+};
+
+#endif
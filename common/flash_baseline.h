@@ -0,0 +1,54 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef FLASH_BASELINE_H
+#define FLASH_BASELINE_H
+
+#include <makestuff.h>
+
+// A FlashBaseline describes what is believed to be on the flash already, so the
+// RegionProgrammer can skip regions whose contents would not change, and skip
+// erasing regions which are already erased, without reading anything back. All
+// addresses are flash byte-addresses; regions are erase regions, and a region
+// written with "length" bytes of data is taken to be padded to its full size
+// with 0xFF, as the RegionProgrammer's erase-then-program leaves it.
+//
+class FlashBaseline {
+public:
+	virtual ~FlashBaseline() { }
+
+	// Return true if the region is known to hold exactly "length" bytes of the
+	// data, padded with 0xFF.
+	virtual bool matches(uint64 address, uint32 regionSize, const uint8 *data, uint32 length) = 0;
+
+	// Return true if the region is known to be erased (i.e all 0xFF).
+	virtual bool isErased(uint64 address, uint32 regionSize) = 0;
+
+	// The given range is about to change, so its contents are no longer known.
+	virtual void forget(uint64 address, uint64 length) = 0;
+
+	// The region now holds "length" bytes of the data, padded with 0xFF.
+	virtual void update(uint64 address, uint32 regionSize, const uint8 *data, uint32 length) = 0;
+
+	// Validation: choose up to "maxCount" whole pages whose contents are known,
+	// writing their addresses into "addresses" and returning how many there are.
+	// Each is then read from the flash and passed to checkPage(), which returns
+	// false if the baseline is wrong about it.
+	virtual uint32 samplePages(uint64 *addresses, uint32 maxCount) = 0;
+	virtual bool checkPage(uint64 address, const uint8 *data) = 0;
+};
+
+#endif
@@ -16,6 +16,7 @@
  */
 #include <cstdio>
 #include <cstring>
+#include <list>
 #include "transport.h"
 #include "exception.h"
 #include "flash_chips.h"
@@ -23,103 +24,460 @@
 #define MAX_PAGESIZE 528
 #define BM_WIP 0x01
 #define BM_POWER2 0x01
+#define BM_COMPARE 0x40
 #define BM_READY 0x80
+#define BM_FLAG_PFAIL 0x10
+#define BM_FLAG_EFAIL 0x20
+#define BM_FLAG_READY 0x80
+
+// Command builders: convert a byte address into the chip's page/offset form,
+// and lay out an opcode followed by an address of "addrBytes" bytes, returning
+// the resulting command length.
+static uint64 toFlashAddress(const FlashChip *flashChip, uint64 address) {
+	const uint64 pageNum = address / flashChip->pageSize;
+	const uint64 pageOffset = address % flashChip->pageSize;
+	return (pageNum << flashChip->bitShift) | pageOffset;
+}
+static uint32 spiCommand(uint8 *command, uint8 opcode, uint32 addrBytes, uint64 flashAddress) {
+	uint32 i;
+	command[0] = opcode;
+	for ( i = addrBytes; i; i-- ) {
+		command[i] = (uint8)flashAddress;
+		flashAddress >>= 8;
+	}
+	return addrBytes + 1;
+}
+
+// Waiters
+static void spiWaitIdle(const FlashChip *flashChip, const Transport *transport) {
+	const uint8 readStatus = 0x05; // read status
+	uint8 status;
+	(void)flashChip;
+	do {
+		transport->sendMessage(&readStatus, 1, &status, 1);
+	} while ( status & BM_WIP );
+}
+static void at45WaitReady(const FlashChip *flashChip, const Transport *transport) {
+	const uint8 readStatus = 0xD7; // read status
+	uint8 status;
+	(void)flashChip;
+	do {
+		transport->sendMessage(&readStatus, 1, &status, 1);
+	} while ( !(status & BM_READY) );
+}
+
+// Address mode switchers
+static void spiEnter4ByteB7(const FlashChip *flashChip, const Transport *transport) {
+	const uint8 enter4Byte = 0xB7; // enter 4-byte address mode
+	(void)flashChip;
+	transport->sendMessage(&enter4Byte, 1);
+}
+static void spiEnter4ByteWrenB7(const FlashChip *flashChip, const Transport *transport) {
+	const uint8 writeEnable = 0x06; // write enable
+	transport->sendMessage(&writeEnable, 1);
+	spiEnter4ByteB7(flashChip, transport);
+}
+static void spiExit4ByteE9(const FlashChip *flashChip, const Transport *transport) {
+	const uint8 exit4Byte = 0xE9; // exit 4-byte address mode
+	(void)flashChip;
+	transport->sendMessage(&exit4Byte, 1);
+}
 
 // Block erasers
 static void spiBlockEraseNull(
-	const FlashChip *flashChip, const Transport *transport, uint32 address)
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
 {
 	(void)flashChip;
 	(void)transport;
 	(void)address;
 }
-static void spiBlockEraseD8(
-	const FlashChip *flashChip, const Transport *transport, uint32 address)
+static void spiBlockEraseStart(
+	const FlashChip *flashChip, const Transport *transport, uint64 address,
+	uint8 opcode, uint32 addrBytes)
 {
-	const uint32 pageNum = (uint32)(address / flashChip->pageSize);
-	const uint32 flashAddress = pageNum << flashChip->bitShift; // pageOffset guaranteed to be zero
 	const uint8 writeEnable = 0x06; // write enable
+	uint8 eraseCommand[5];
+	const uint32 cmdLength = spiCommand(
+		eraseCommand, opcode, addrBytes,
+		toFlashAddress(flashChip, address)  // pageOffset guaranteed to be zero
+	);
+	transport->sendMessage(&writeEnable, 1);
+	transport->sendMessage(eraseCommand, cmdLength);
+}
+static void spiBlockErase(
+	const FlashChip *flashChip, const Transport *transport, uint64 address,
+	uint8 opcode, uint32 addrBytes)
+{
+	spiBlockEraseStart(flashChip, transport, address, opcode, addrBytes);
+	spiWaitIdle(flashChip, transport);
+}
+static void spiBlockEraseD8(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	spiBlockErase(flashChip, transport, address, 0xD8, 3);  // erase block
+}
+static void spiBlockEraseD8A4(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	spiBlockErase(flashChip, transport, address, 0xD8, 4);  // erase block, in 4-byte mode
+}
+static void spiBlockEraseDC(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	spiBlockErase(flashChip, transport, address, 0xDC, 4);  // erase block with 4-byte address
+}
+static void spiBlockErase20(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	spiBlockErase(flashChip, transport, address, 0x20, 3);  // erase 4KiB sector
+}
+static void spiBlockErase20A4(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	spiBlockErase(flashChip, transport, address, 0x20, 4);  // erase 4KiB sector, in 4-byte mode
+}
+static void spiBlockErase21(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	spiBlockErase(flashChip, transport, address, 0x21, 4);  // erase 4KiB sector with 4-byte address
+}
+
+
+// Erase suspend/resume, for chips with the usual 0x75/0x7A opcodes. The erase is
+// started without waiting, and the RegionProgrammer polls it to completion.
+static void spiEraseStartD8(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	spiBlockEraseStart(flashChip, transport, address, 0xD8, 3);  // erase block
+}
+static void spiEraseStartDC(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	spiBlockEraseStart(flashChip, transport, address, 0xDC, 4);  // erase block with 4-byte address
+}
+static bool spiBusy05(const FlashChip *flashChip, const Transport *transport, uint64 address) {
 	const uint8 readStatus = 0x05; // read status
 	uint8 status;
-	const uint8 eraseCommand[] = {
-		0xD8,  // erase block
-		(uint8)(flashAddress >> 16),
-		(uint8)(flashAddress >> 8),
-		(uint8)flashAddress
-	};
-	transport->sendMessage(&writeEnable, 1);
+	(void)flashChip;
+	(void)address;
+	transport->sendMessage(&readStatus, 1, &status, 1);
+	return (status & BM_WIP) != 0;
+}
+static void spiSuspend75(const FlashChip *flashChip, const Transport *transport) {
+	const uint8 suspend = 0x75; // erase suspend
+	transport->sendMessage(&suspend, 1);
+	spiWaitIdle(flashChip, transport); // WIP clears once the array is readable
+}
+static void spiResume7A(const FlashChip *flashChip, const Transport *transport) {
+	const uint8 resume = 0x7A; // erase resume (ignored if the erase already finished)
+	(void)flashChip;
+	transport->sendMessage(&resume, 1);
+}
+static const EraseSuspend spiSuspendD8 = {
+	spiEraseStartD8,
+	spiBusy05,
+	spiSuspend75,
+	spiResume7A
+};
+static const EraseSuspend spiSuspendDC = {
+	spiEraseStartDC,
+	spiBusy05,
+	spiSuspend75,
+	spiResume7A
+};
+
+static void spiBlockErase50(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	uint8 eraseCommand[4];
+	spiCommand(
+		eraseCommand, 0x50, 3,  // block erase
+		toFlashAddress(flashChip, address)  // pageOffset guaranteed to be zero
+	);
+	at45WaitReady(flashChip, transport); // a buffer commit may still be in progress
 	transport->sendMessage(eraseCommand, 4);
-	do {
-		transport->sendMessage(&readStatus, 1, &status, 1);
-	} while ( status & BM_WIP );
+	at45WaitReady(flashChip, transport);
 }
 
 // Page programmers
-static void spiPageProgram02(
+static void spiPageProgramStart(
 	const FlashChip *flashChip, const Transport *transport,
-	uint32 address, uint32 length, const uint8 *data)
+	uint64 address, uint32 length, const uint8 *data,
+	uint8 opcode, uint32 addrBytes)
 {
-	const uint32 pageNum = (uint32)(address / flashChip->pageSize);
-	const uint32 flashAddress = pageNum << flashChip->bitShift; // pageOffset guaranteed to be zero
 	const uint8 writeEnable = 0x06; // write enable
-	const uint8 readStatus = 0x05; // read status
-	uint8 writeCommand[MAX_PAGESIZE + 4];
+	uint8 writeCommand[MAX_PAGESIZE + 5];
+	const uint32 cmdLength = spiCommand(
+		writeCommand, opcode, addrBytes,
+		toFlashAddress(flashChip, address)  // pageOffset guaranteed to be zero
+	);
+	uint32 i;
+	memcpy(writeCommand + cmdLength, data, length);
+	for ( i = length; i < flashChip->pageSize; i++ ) {
+		*(writeCommand + cmdLength + i) = 0xFF;
+	}
+	transport->sendMessage(&writeEnable, 1);
+	transport->sendMessage(writeCommand, flashChip->pageSize + cmdLength);
+}
+static void spiPageProgram(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data,
+	uint8 opcode, uint32 addrBytes)
+{
+	spiPageProgramStart(flashChip, transport, address, length, data, opcode, addrBytes);
+	spiWaitIdle(flashChip, transport);
+}
+static void spiPageProgram02(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data)
+{
+	spiPageProgram(flashChip, transport, address, length, data, 0x02, 3);  // page program
+}
+static void spiPageProgram02A4(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data)
+{
+	spiPageProgram(flashChip, transport, address, length, data, 0x02, 4);  // page program, in 4-byte mode
+}
+static void spiPageProgram12(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data)
+{
+	spiPageProgram(flashChip, transport, address, length, data, 0x12, 4);  // page program with 4-byte address
+}
+
+// Micron parts report completion, and any failure, in the flag status register.
+// On failure, the flags are cleared before throwing, so the chip stays usable.
+static uint8 micronFlagStatus(const Transport *transport) {
+	const uint8 readFlags = 0x70; // read flag status
+	uint8 status;
+	transport->sendMessage(&readFlags, 1, &status, 1);
+	return status;
+}
+static void micronCheckFlags(const Transport *transport, uint8 status, const char *operation, uint64 address) {
+	if ( status & (BM_FLAG_EFAIL | BM_FLAG_PFAIL) ) {
+		const uint8 clearFlags = 0x50; // clear flag status
+		char msg[256];
+		transport->sendMessage(&clearFlags, 1);
+		sprintf(
+			msg, "Flash %s failed at address 0x%08llX (flag status 0x%02X)!",
+			operation, (unsigned long long)address, status
+		);
+		throw GordonException(msg);
+	}
+}
+static void micronWaitReady(const Transport *transport, const char *operation, uint64 address) {
 	uint8 status;
+	do {
+		status = micronFlagStatus(transport);
+	} while ( !(status & BM_FLAG_READY) );
+	micronCheckFlags(transport, status, operation, address);
+}
+static void micronBlockEraseD8(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	spiBlockEraseStart(flashChip, transport, address, 0xD8, 3);  // erase block
+	micronWaitReady(transport, "erase", address);
+}
+static void micronPageProgram02(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data)
+{
+	spiPageProgramStart(flashChip, transport, address, length, data, 0x02, 3);  // page program
+	micronWaitReady(transport, "program", address);
+}
+static bool micronBusy70(const FlashChip *flashChip, const Transport *transport, uint64 address) {
+	const uint8 status = micronFlagStatus(transport);
+	(void)flashChip;
+	if ( !(status & BM_FLAG_READY) ) {
+		return true;
+	}
+	micronCheckFlags(transport, status, "erase", address);
+	return false;
+}
+static void micronSuspend75(const FlashChip *flashChip, const Transport *transport) {
+	const uint8 suspend = 0x75; // erase suspend
+	(void)flashChip;
+	transport->sendMessage(&suspend, 1);
+	while ( !(micronFlagStatus(transport) & BM_FLAG_READY) );
+}
+static const EraseSuspend micronSuspendD8 = {
+	spiEraseStartD8,
+	micronBusy70,
+	micronSuspend75,
+	spiResume7A
+};
+
+static void spiPageProgram82(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data)
+{
+	uint8 writeCommand[MAX_PAGESIZE + 4];
 	uint32 i;
-	writeCommand[0] = 0x02;  // page program
-	writeCommand[1] = (uint8)(flashAddress >> 16);
-	writeCommand[2] = (uint8)(flashAddress >> 8);
-	writeCommand[3] = (uint8)flashAddress;
+	spiCommand(
+		writeCommand, 0x82, 3,  // page program
+		toFlashAddress(flashChip, address)  // pageOffset guaranteed to be zero
+	);
 	memcpy(writeCommand + 4, data, length);
 	for ( i = length; i < flashChip->pageSize; i++ ) {
 		*(writeCommand + 4 + i) = 0xFF;
 	}
-	transport->sendMessage(&writeEnable, 1);
 	transport->sendMessage(writeCommand, flashChip->pageSize + 4);
-	do {
-		transport->sendMessage(&readStatus, 1, &status, 1);
-	} while ( status & BM_WIP );
+	at45WaitReady(flashChip, transport);
 }
 
-static void spiPageProgram82(
+// Program a page which has already been erased by spiBlockErase50(). The two
+// SRAM buffers are used alternately, so the next page can be loaded into one
+// whilst the previous page is still being committed from the other. The final
+// commit is left running; at45WaitReady() must be called to wait for it.
+static void spiPageProgram88(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data)
+{
+	const bool useBuffer2 = ((address / flashChip->pageSize) & 1) != 0;
+	uint8 commitCommand[4];
+	uint8 writeCommand[MAX_PAGESIZE + 4];
+	uint32 i;
+	spiCommand(
+		commitCommand, useBuffer2 ? 0x89 : 0x88, 3,  // buffer to main memory without erase
+		toFlashAddress(flashChip, address)  // pageOffset guaranteed to be zero
+	);
+	spiCommand(writeCommand, useBuffer2 ? 0x87 : 0x84, 3, 0x000000);  // buffer write
+	memcpy(writeCommand + 4, data, length);
+	for ( i = length; i < flashChip->pageSize; i++ ) {
+		*(writeCommand + 4 + i) = 0xFF;
+	}
+	transport->sendMessage(writeCommand, flashChip->pageSize + 4);
+	at45WaitReady(flashChip, transport);
+	transport->sendMessage(commitCommand, 4);
+}
+
+// Patch part of a page in place: the page is transferred into SRAM buffer 1, the
+// new bytes are written over it there, and the buffer is committed with erase.
+// So only the new bytes cross the wire, and the rest of the page is unchanged.
+static void at45PagePatch53(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data)
+{
+	const uint64 pageAddress = address - address % flashChip->pageSize;
+	uint8 command[4];
+	uint8 writeCommand[MAX_PAGESIZE + 4];
+	spiCommand(command, 0x53, 3, toFlashAddress(flashChip, pageAddress));  // main memory page to buffer 1
+	at45WaitReady(flashChip, transport); // a buffer commit may still be in progress
+	transport->sendMessage(command, 4);
+	at45WaitReady(flashChip, transport);
+	spiCommand(writeCommand, 0x84, 3, address % flashChip->pageSize);  // buffer 1 write
+	memcpy(writeCommand + 4, data, length);
+	transport->sendMessage(writeCommand, length + 4);
+	spiCommand(command, 0x83, 3, toFlashAddress(flashChip, pageAddress));  // buffer 1 to main memory with erase
+	transport->sendMessage(command, 4);
+	at45WaitReady(flashChip, transport);
+}
+
+// Page verifiers
+static bool spiPageVerify60(
 	const FlashChip *flashChip, const Transport *transport,
-	uint32 address, uint32 length, const uint8 *data)
+	uint64 address, uint32 length, const uint8 *data)
 {
-	const uint32 pageNum = (uint32)(address / flashChip->pageSize);
-	const uint32 flashAddress = pageNum << flashChip->bitShift; // pageOffset guaranteed to be zero
 	const uint8 readStatus = 0xD7; // read status
+	uint8 compareCommand[4];
 	uint8 writeCommand[MAX_PAGESIZE + 4];
 	uint8 status;
 	uint32 i;
-	writeCommand[0] = 0x82;  // page program
-	writeCommand[1] = (uint8)(flashAddress >> 16);
-	writeCommand[2] = (uint8)(flashAddress >> 8);
-	writeCommand[3] = (uint8)flashAddress;
+	spiCommand(
+		compareCommand, 0x60, 3,  // main memory page to buffer compare
+		toFlashAddress(flashChip, address)  // pageOffset guaranteed to be zero
+	);
+	spiCommand(writeCommand, 0x84, 3, 0x000000);  // buffer write
 	memcpy(writeCommand + 4, data, length);
 	for ( i = length; i < flashChip->pageSize; i++ ) {
 		*(writeCommand + 4 + i) = 0xFF;
 	}
 	transport->sendMessage(writeCommand, flashChip->pageSize + 4);
+	transport->sendMessage(compareCommand, 4);
 	do {
 		transport->sendMessage(&readStatus, 1, &status, 1);
 	} while ( !(status & BM_READY) );
+	return !(status & BM_COMPARE);
 }
 
 // Readers
+static void spiRead(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, uint8 *buffer,
+	uint8 opcode, uint32 addrBytes, uint32 dummyBytes)
+{
+	uint8 readCommand[10];
+	uint32 cmdLength = spiCommand(
+		readCommand, opcode, addrBytes, toFlashAddress(flashChip, address)
+	);
+	while ( dummyBytes-- ) {
+		readCommand[cmdLength++] = 0x00;
+	}
+	transport->sendMessage(readCommand, cmdLength, buffer, length);
+}
 static void spiRead03(
 	const FlashChip *flashChip, const Transport *transport,
-	uint32 address, uint32 length, uint8 *buffer)
+	uint64 address, uint32 length, uint8 *buffer)
+{
+	spiRead(flashChip, transport, address, length, buffer, 0x03, 3, 0);  // read flash
+}
+static void spiRead03A4(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, uint8 *buffer)
+{
+	spiRead(flashChip, transport, address, length, buffer, 0x03, 4, 0);  // read flash, in 4-byte mode
+}
+static void spiRead13(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, uint8 *buffer)
+{
+	spiRead(flashChip, transport, address, length, buffer, 0x13, 4, 0);  // read flash with 4-byte address
+}
+
+// Fast read. Unlike 0x03, the 0x0B opcode is specified up to the chip's full
+// clock rate, at the cost of one dummy byte. On DataFlash it is the continuous
+// array read: the chip increments through the page/offset address itself,
+// rolling over from the end of one page to the start of the next in either
+// page layout, so a linear read of any length is a single transaction.
+static void spiRead0B(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, uint8 *buffer)
+{
+	spiRead(flashChip, transport, address, length, buffer, 0x0B, 3, 1);  // fast read
+}
+static void spiRead0BA4(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, uint8 *buffer)
+{
+	spiRead(flashChip, transport, address, length, buffer, 0x0B, 4, 1);  // fast read, in 4-byte mode
+}
+static void spiRead0C(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, uint8 *buffer)
 {
-	const uint32 pageNum = (uint32)(address / flashChip->pageSize);
-	const uint32 pageOffset = (uint32)(address % flashChip->pageSize);
-	const uint32 flashAddress = (pageNum << flashChip->bitShift) | pageOffset;
-	const uint8 readCommand[] = {
-		0x03,  // read flash
-		(uint8)(flashAddress >> 16),
-		(uint8)(flashAddress >> 8),
-		(uint8)flashAddress
-	};
-	transport->sendMessage(readCommand, 4, buffer, length);
+	spiRead(flashChip, transport, address, length, buffer, 0x0C, 4, 1);  // fast read with 4-byte address
+}
+
+// Unique ID readers
+static uint32 spiUniqueId4B(const Transport *transport, uint8 *buffer) {
+	const uint8 readUniqueId[] = {0x4B, 0x00, 0x00, 0x00, 0x00}; // read unique ID, four dummy bytes
+	transport->sendMessage(readUniqueId, 5, buffer, 8);
+	return 8;
+}
+static uint32 spiUniqueId9F(const Transport *transport, uint8 *buffer) {
+	const uint8 readIdent = 0x9F; // JEDEC ID, extended with the 16-byte unique ID
+	uint8 buf[20];
+	transport->sendMessage(&readIdent, 1, buf, 20);
+	memcpy(buffer, buf + 4, 16);
+	return 16;
+}
+static uint32 at45UniqueId77(const Transport *transport, uint8 *buffer) {
+	const uint8 readSecurity[] = {0x77, 0x00, 0x00, 0x00}; // read security register
+	uint8 buf[128];
+	transport->sendMessage(readSecurity, 4, buf, 128);
+	memcpy(buffer, buf + 64, 64);  // the upper half is programmed in the factory
+	return 64;
 }
 
 // Selectors
@@ -134,203 +492,468 @@ static uint32 powerTwoSelector(const Transport *transport) {
 	return (status & BM_POWER2) ? 1 : 0;
 }
 
-#define ST_ID 0x20
-#define AMIC_ID 0x7F37
-#define ATMEL_ID 0x1F
-#define WINBOND_NEX_ID 0xEF  /* Winbond (ex Nexcom) serial flashes */
-
-#define ST_M25P10 0x2011
-#define ST_M25P40 0x2013
-#define ST_N25Q128 0xBA18
-#define AMIC_A25L05PT 0x2020
-#define AMIC_A25L40PT 0x2013
-#define ATMEL_AT45DB041D 0x2400
-#define ATMEL_AT45DB161D 0x2600
-#define WINBOND_NEX_W25Q64_V 0x4017
-
-static const FlashChip flashChips[] = {
-	{
-		"AMIC",
-		"A25L05PT",
-		AMIC_ID,
-		AMIC_A25L05PT,
-		64,  // device size in KiB
-		256,  // page size in bytes
-		8,
-		{
-			{32 * 1024, 1},
-			{16 * 1024, 1},
-			{8 * 1024, 1},
-			{4 * 1024, 2}
-		},
-		spiBlockEraseD8,
-		spiPageProgram02,
-		spiRead03,
-		nullSelector
-	}, {
-		"AMIC",
-		"A25L40PT",
-		AMIC_ID,
-		AMIC_A25L40PT,
-		512,  // device size in KiB
-		256,  // page size in bytes
-		8,
-		{
-			{64 * 1024, 7},
-			{32 * 1024, 1},
-			{16 * 1024, 1},
-			{8 * 1024, 1},
-			{4 * 1024, 2},
-		},
-		spiBlockEraseD8,
-		spiPageProgram02,
-		spiRead03,
-		nullSelector
-	}, {
-		"Micron/Numonyx/ST",
-		"M25P10",
-		ST_ID,
-		ST_M25P10,
-		128,  // device size in KiB
-		256,  // page size in bytes
-		8,
-		{
-			{32 * 1024, 4}  // block size, num blocks
-		},
-		spiBlockEraseD8,
-		spiPageProgram02,
-		spiRead03,
-		nullSelector
-	}, {
-		"Micron/Numonyx/ST",
-		"M25P40",
-		ST_ID,
-		ST_M25P40,
-		512,  // device size in KiB
-		256,  // page size in bytes
-		8,
-		{
-			{64 * 1024, 8}  // block size, num blocks
-		},
-		spiBlockEraseD8,
-		spiPageProgram02,
-		spiRead03,
-		nullSelector
-	}, {
-		"Micron/Numonyx/ST",
-		"N25Q128",
-		ST_ID,
-		ST_N25Q128,
-		16384,  // device size in KiB
-		256,    // page size in bytes
-		8,
-		{
-			{64 * 1024, 256}  // block size, num blocks
-		},
-		spiBlockEraseD8,
-		spiPageProgram02,
-		spiRead03,
-		nullSelector
-	}, {
-		"Atmel",
-		"AT45DB041D",
-		ATMEL_ID,
-		ATMEL_AT45DB041D,
-		528,  // device size in KiB
-		264,  // page size in bytes
-		9,
-		{
-			{264, 2048}  // block size, num blocks
-		},
-		spiBlockEraseNull,
-		spiPageProgram82,
-		spiRead03,
-		powerTwoSelector
-	}, {
-		"Atmel",
-		"AT45DB041D",
-		ATMEL_ID,
-		ATMEL_AT45DB041D,
-		512, // device size in KiB
-		256,  // page size in bytes
-		9,
-		{
-			{264, 2048}  // block size, num blocks
-		},
-		spiBlockEraseNull,
-		spiPageProgram82,
-		spiRead03,
-		NULL
-	}, {
-		"Atmel",
-		"AT45DB161D",
-		ATMEL_ID,
-		ATMEL_AT45DB161D,
-		2112, // device size in KiB
-		528,  // page size in bytes
-		10,
-		{
-			{528, 4096}  // block size, num blocks
-		},
-		spiBlockEraseNull,
-		spiPageProgram82,
-		spiRead03,
-		powerTwoSelector
-	}, {
-		"Atmel",
-		"AT45DB161D",
-		ATMEL_ID,
-		ATMEL_AT45DB161D,
-		2048, // device size in KiB
-		512,  // page size in bytes
-		9,
-		{
-			{512, 4096}  // block size, num blocks
-		},
-		spiBlockEraseNull,
-		spiPageProgram82,
-		spiRead03,
-		NULL
-	}, {
-		"Winbond",
-		"W25Q64.V",
-		WINBOND_NEX_ID,
-		WINBOND_NEX_W25Q64_V,
-		8192,  // device size in KiB
-		256,  // page size in bytes
-		8,
-		{
-			{64 * 1024, 128}  // block size, num blocks
-		},
-		spiBlockEraseD8,
-		spiPageProgram02,
-		spiRead03,
-		nullSelector
-	}, {
-		NULL, NULL, 0, 0, 0, 0, 0, {{0, 0}}, NULL, NULL, NULL, NULL
+// Bulk writers
+static const BulkWrite at45BulkWrite = {
+	8,  // pages per block
+	spiBlockErase50,
+	spiPageProgram88,
+	at45WaitReady
+};
+
+// SPI NAND. These chips are page-addressed: a page is transferred between the
+// array and an on-chip cache with one command (addressed by a 24-bit row, i.e
+// page, address), and between the cache and the host with another (addressed by
+// a 16-bit column address within the page). Program and erase failures are
+// reported in the status register, and blocks marked bad at the factory have a
+// non-0xFF byte at the start of the spare area of their first page.
+//
+#define MAX_NAND_PAGESIZE 4096
+#define NAND_STATUS 0xC0
+#define NAND_PROTECT 0xA0
+#define NAND_CONFIG 0xB0
+#define BM_NAND_BUSY 0x01
+#define BM_NAND_EFAIL 0x04
+#define BM_NAND_PFAIL 0x08
+#define BM_NAND_BUF 0x08
+
+static uint8 nandGetFeature(const Transport *transport, uint8 reg) {
+	const uint8 getFeature[] = {0x0F, reg};  // get feature
+	uint8 value;
+	transport->sendMessage(getFeature, 2, &value, 1);
+	return value;
+}
+static void nandSetFeature(const Transport *transport, uint8 reg, uint8 value) {
+	const uint8 setFeature[] = {0x1F, reg, value};  // set feature
+	transport->sendMessage(setFeature, 3);
+}
+static uint8 nandWaitIdle(const Transport *transport) {
+	uint8 status;
+	do {
+		status = nandGetFeature(transport, NAND_STATUS);
+	} while ( status & BM_NAND_BUSY );
+	return status;
+}
+static void nandPageToCache(const FlashChip *flashChip, const Transport *transport, uint64 address) {
+	uint8 readCommand[4];
+	spiCommand(readCommand, 0x13, 3, address / flashChip->pageSize);  // page data read
+	transport->sendMessage(readCommand, 4);
+	nandWaitIdle(transport);
+}
+
+// Clear the block-protect bits (which are set at power-on) and select buffer
+// read mode, in which reads from the cache are bounded by the page.
+static void nandEnterW25N(const FlashChip *flashChip, const Transport *transport) {
+	(void)flashChip;
+	nandSetFeature(transport, NAND_PROTECT, 0x00);
+	nandSetFeature(transport, NAND_CONFIG, nandGetFeature(transport, NAND_CONFIG) | BM_NAND_BUF);
+}
+
+static void nandBlockEraseD8(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	const uint8 writeEnable = 0x06; // write enable
+	uint8 eraseCommand[4];
+	spiCommand(eraseCommand, 0xD8, 3, address / flashChip->pageSize);  // block erase
+	transport->sendMessage(&writeEnable, 1);
+	transport->sendMessage(eraseCommand, 4);
+	if ( nandWaitIdle(transport) & BM_NAND_EFAIL ) {
+		char msg[256];
+		sprintf(msg, "nandBlockEraseD8(): Erase failed for the block at address 0x%08llX!", (unsigned long long)address);
+		throw GordonException(msg);
 	}
+}
+
+static void nandPageProgram02(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data)
+{
+	const uint8 writeEnable = 0x06; // write enable
+	uint8 loadCommand[MAX_NAND_PAGESIZE + 3];
+	uint8 executeCommand[4];
+	uint32 i;
+	spiCommand(loadCommand, 0x02, 2, 0x0000);  // program data load, from column zero
+	memcpy(loadCommand + 3, data, length);
+	for ( i = length; i < flashChip->pageSize; i++ ) {
+		*(loadCommand + 3 + i) = 0xFF;
+	}
+	spiCommand(executeCommand, 0x10, 3, address / flashChip->pageSize);  // program execute
+	transport->sendMessage(&writeEnable, 1);
+	transport->sendMessage(loadCommand, flashChip->pageSize + 3);
+	transport->sendMessage(executeCommand, 4);
+	if ( nandWaitIdle(transport) & BM_NAND_PFAIL ) {
+		char msg[256];
+		sprintf(msg, "nandPageProgram02(): Program failed for the page at address 0x%08llX!", (unsigned long long)address);
+		throw GordonException(msg);
+	}
+}
+
+// Any partial page at either end is read in buffer mode. The page-aligned run
+// in between is streamed in continuous read mode, in which the chip moves each
+// page into the cache itself as the previous one is clocked out, so there is
+// just one transaction at the chip's streaming rate.
+static void nandRead03(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, uint8 *buffer)
+{
+	const uint32 pageSize = flashChip->pageSize;
+	uint8 readCommand[4];
+	while ( length && (address % pageSize || length < pageSize) ) {
+		const uint32 column = (uint32)(address % pageSize);
+		const uint32 chunkLength = (length > pageSize - column) ? pageSize - column : length;
+		nandPageToCache(flashChip, transport, address);
+		spiCommand(readCommand, 0x03, 2, column);  // read from cache
+		readCommand[3] = 0x00;  // dummy
+		transport->sendMessage(readCommand, 4, buffer, chunkLength);
+		address += chunkLength;
+		length -= chunkLength;
+		buffer += chunkLength;
+	}
+	if ( length ) {
+		const uint8 config = nandGetFeature(transport, NAND_CONFIG);
+		nandSetFeature(transport, NAND_CONFIG, config & ~BM_NAND_BUF);
+		nandPageToCache(flashChip, transport, address);
+		spiCommand(readCommand, 0x03, 3, 0x000000);  // continuous read; dummy bytes only
+		transport->sendMessage(readCommand, 4, buffer, length);
+		nandSetFeature(transport, NAND_CONFIG, config | BM_NAND_BUF);
+	}
+}
+
+static bool nandBadBlock(
+	const FlashChip *flashChip, const Transport *transport, uint64 address)
+{
+	uint8 readCommand[4];
+	uint8 marker;
+	nandPageToCache(flashChip, transport, address);
+	spiCommand(readCommand, 0x03, 2, flashChip->pageSize);  // read from cache, first spare byte
+	readCommand[3] = 0x00;  // dummy
+	transport->sendMessage(readCommand, 4, &marker, 1);
+	return marker != 0xFF;
+}
+
+// The FlashChip table and its perfect-hash index, generated by genchips.py from
+// chipcheck/gordon_chips.def and, optionally, flashrom's flashchips.c.
+//
+#include "flash_chip_table.inc"
+
+// SFDP discovery. Chips which are not in the table above may still describe
+// themselves with a JEDEC JESD216 Serial Flash Discoverable Parameters table.
+// The Basic Flash Parameter Table gives the capacity, page size, erase types
+// and timings, and addressing; the optional 4-byte Address Instruction Table
+// gives the dedicated 4-byte opcodes. These are mapped onto the functions
+// above. All Transports are single-lane, so only the 1-1-1 fast read is used;
+// the dual and quad read modes are of no benefit.
+//
+#define SFDP_SIGNATURE 0x50444653  // "SFDP", little-endian
+#define SFDP_BFPT_ID 0xFF00
+#define SFDP_4BAIT_ID 0xFF84
+#define SFDP_MAX_HEADERS 16
+
+struct SfdpChip {
+	FlashChip chip;
+	char vendorName[32];
+	char deviceName[32];
 };
+static std::list<SfdpChip> sfdpChips;
 
-const FlashChip *findChip(const Transport *transport) {
+static void sfdpRead(const Transport *transport, uint32 address, uint32 length, uint8 *buffer) {
+	uint8 readCommand[5];
+	spiCommand(readCommand, 0x5A, 3, address);  // read SFDP
+	readCommand[4] = 0x00;  // dummy
+	transport->sendMessage(readCommand, 5, buffer, length);
+}
+
+static uint32 le32(const uint8 *ptr) {
+	return (uint32)ptr[0] | ((uint32)ptr[1] << 8) | ((uint32)ptr[2] << 16) | ((uint32)ptr[3] << 24);
+}
+
+// Read the parameter table with the given ID into "dwords" (which is zeroed
+// first), returning its length in DWORDs, or zero if there is no such table.
+static uint32 sfdpTable(
+	const Transport *transport, const uint8 *headers, uint32 numHeaders, uint32 id,
+	uint32 *dwords)
+{
+	uint8 buf[4 * SFDP_MAX_DWORDS];
+	uint32 i, numDwords;
+	for ( i = 0; i < numHeaders; i++ ) {
+		const uint8 *const header = headers + 8 * i;
+		if ( (uint32)((header[7] << 8) | header[0]) == id ) {
+			break;
+		}
+	}
+	memset(dwords, 0, 4 * SFDP_MAX_DWORDS);
+	if ( i == numHeaders ) {
+		return 0;
+	}
+	numDwords = headers[8 * i + 3];
+	if ( numDwords > SFDP_MAX_DWORDS ) {
+		numDwords = SFDP_MAX_DWORDS;
+	}
+	sfdpRead(transport, le32(headers + 8 * i + 4) & 0xFFFFFF, 4 * numDwords, buf);
+	for ( i = 0; i < numDwords; i++ ) {
+		dwords[i] = le32(buf + 4 * i);
+	}
+	return numDwords;
+}
+
+static const char *vendorName(uint32 vendorID) {
+	switch ( vendorID ) {
+	case ST_ID: return "Micron/Numonyx/ST";
+	case AMIC_ID: return "AMIC";
+	case ATMEL_ID: return "Atmel";
+	case MACRONIX_ID: return "Macronix";
+	case WINBOND_NEX_ID: return "Winbond";
+	default: return NULL;
+	}
+}
+
+bool readSfdpTables(const Transport *transport, SfdpTables *tables) {
+	uint8 headers[8 * (SFDP_MAX_HEADERS + 1)];
+	uint32 numHeaders;
+
+	// Read the SFDP header and the parameter headers which follow it
+	sfdpRead(transport, 0x000000, 8, headers);
+	if ( le32(headers) != SFDP_SIGNATURE ) {
+		return false;
+	}
+	numHeaders = headers[6] + 1U;
+	if ( numHeaders > SFDP_MAX_HEADERS ) {
+		numHeaders = SFDP_MAX_HEADERS;
+	}
+	sfdpRead(transport, 0x000008, 8 * numHeaders, headers);
+	tables->bfptLength = sfdpTable(transport, headers, numHeaders, SFDP_BFPT_ID, tables->bfpt);
+	tables->fourByteLength = sfdpTable(transport, headers, numHeaders, SFDP_4BAIT_ID, tables->fourByte);
+	return tables->bfptLength != 0;
+}
+
+const FlashChip *sfdpChip(uint32 vendorID, uint32 deviceID, const SfdpTables *tables) {
+	const uint32 *const bfpt = tables->bfpt;
+	const uint32 *const fourByte = tables->fourByte;
+	const uint32 bfptLength = tables->bfptLength;
+	const uint32 fourByteLength = tables->fourByteLength;
+	uint32 i;
+	uint32 eraseIndex = 0, eraseSize = 0, eraseOpcode = 0;
+	uint64 capacity;
+	bool wide, modeEntry = false;
+	SfdpChip sfdp;
+	FlashChip *const chip = &sfdp.chip;
+
+	if ( bfptLength < 9 ) {
+		return NULL;
+	}
+
+	// Capacity, given in bits, either directly or as a power of two
+	if ( bfpt[1] & 0x80000000 ) {
+		const uint32 exponent = bfpt[1] & 0x7FFFFFFF;
+		if ( exponent < 3 || exponent > 66 ) {
+			return NULL;
+		}
+		capacity = (uint64)1 << (exponent - 3);
+	} else {
+		capacity = ((uint64)bfpt[1] + 1) / 8;
+	}
+	if ( !capacity || capacity / 1024 > 0xFFFFFFFFU ) {
+		return NULL;
+	}
+
+	// Choose the biggest of the erase types for which there is an erase function
+	for ( i = 0; i < 4; i++ ) {
+		const uint32 sizeShift = (bfpt[7 + i / 2] >> (16 * (i % 2))) & 0xFF;
+		const uint32 opcode = (bfpt[7 + i / 2] >> (16 * (i % 2) + 8)) & 0xFF;
+		if ( (opcode == 0xD8 && sizeShift == 16) || (opcode == 0x20 && sizeShift == 12) ) {
+			if ( (1U << sizeShift) > eraseSize ) {
+				eraseIndex = i;
+				eraseSize = 1U << sizeShift;
+				eraseOpcode = opcode;
+			}
+		}
+	}
+	if ( !eraseSize || capacity % eraseSize ) {
+		return NULL;
+	}
+
+	memset(&sfdp, 0, sizeof(sfdp));
+	if ( vendorName(vendorID) ) {
+		sprintf(sfdp.vendorName, "%s", vendorName(vendorID));
+	} else {
+		sprintf(sfdp.vendorName, "Unknown (0x%02X)", vendorID);
+	}
+	sprintf(sfdp.deviceName, "SFDP device 0x%04X", deviceID);
+	chip->vendorID = vendorID;
+	chip->deviceID = deviceID;
+	chip->kbCapacity = (uint32)(capacity / 1024);
+	chip->pageSize = 256;
+	if ( bfptLength >= 11 && ((bfpt[10] >> 4) & 0xF) ) {
+		// Pages bigger than the page-program functions' buffers are programmed
+		// 256 bytes at a time, which every part allows
+		chip->pageSize = 1U << ((bfpt[10] >> 4) & 0xF);
+		if ( chip->pageSize > MAX_PAGESIZE ) {
+			chip->pageSize = 256;
+		}
+		chip->programTimeUs = (((bfpt[10] >> 8) & 0x1F) + 1) * ((bfpt[10] & (1 << 13)) ? 64 : 8);
+	}
+	for ( chip->bitShift = 0; (1U << chip->bitShift) < chip->pageSize; chip->bitShift++ );
+	chip->eraseRegions[0].size = eraseSize;
+	chip->eraseRegions[0].count = (uint32)(capacity / eraseSize);
+	if ( bfptLength >= 10 ) {
+		static const uint32 units[] = {1, 16, 128, 1000};
+		const uint32 timing = bfpt[9] >> (4 + 7 * eraseIndex);
+		chip->eraseTimeMs = ((timing & 0x1F) + 1) * units[(timing >> 5) & 0x3];
+	}
+
+	// Addressing: parts bigger than 16MiB need 4 address bytes, preferably with
+	// the dedicated opcodes, else by switching into 4-byte mode. Some parts are
+	// permanently in 4-byte mode.
+	wide = (capacity > 0x1000000) || ((bfpt[0] >> 17) & 0x3) == 0x2;
+	if ( wide && ((bfpt[0] >> 17) & 0x3) != 0x2 ) {
+		const bool fourByteErase =
+			fourByteLength >= 2 &&
+			(fourByte[0] & (1 << (9 + eraseIndex))) &&
+			((fourByte[1] >> (8 * eraseIndex)) & 0xFF) == (eraseOpcode == 0xD8 ? 0xDCU : 0x21U);
+		if ( fourByteErase && (fourByte[0] & 0x42) == 0x42 ) {
+			chip->blockEraseFunc = (eraseOpcode == 0xD8) ? spiBlockEraseDC : spiBlockErase21;
+			chip->pageProgramFunc = spiPageProgram12;
+			chip->readFunc = spiRead0C;
+		} else if ( bfptLength >= 16 && (bfpt[15] & (3 << 24)) && (bfpt[15] & (1 << 14)) ) {
+			chip->enterFunc = (bfpt[15] & (1 << 24)) ? spiEnter4ByteB7 : spiEnter4ByteWrenB7;
+			chip->exitFunc = spiExit4ByteE9;
+			modeEntry = true;
+		} else {
+			return NULL;
+		}
+	}
+	if ( !chip->blockEraseFunc ) {
+		if ( wide || modeEntry ) {
+			chip->blockEraseFunc = (eraseOpcode == 0xD8) ? spiBlockEraseD8A4 : spiBlockErase20A4;
+			chip->pageProgramFunc = spiPageProgram02A4;
+			chip->readFunc = spiRead0BA4;
+		} else {
+			chip->blockEraseFunc = (eraseOpcode == 0xD8) ? spiBlockEraseD8 : spiBlockErase20;
+			chip->pageProgramFunc = spiPageProgram02;
+			chip->readFunc = spiRead0B;
+		}
+	}
+	chip->selectorFunc = nullSelector;
+
+	// Keep the descriptor for the life of the process
+	sfdpChips.push_back(sfdp);
+	sfdpChips.back().chip.vendorName = sfdpChips.back().vendorName;
+	sfdpChips.back().chip.deviceName = sfdpChips.back().deviceName;
+	return &sfdpChips.back().chip;
+}
+
+// The table is indexed by a minimal perfect hash of the vendor ID, device ID
+// and variant, whose seeds genchips.py found and emitted with the table: the
+// key's bucket gives the seed, and the seeded hash gives the one slot the key
+// can be in, so a lookup is two hashes and one comparison whatever the size of
+// the table. This must match chip_hash() in genchips.py.
+//
+static uint32 chipHash(uint32 vendorID, uint32 deviceID, uint32 variant, uint32 seed) {
+	uint32 hash = (vendorID ^ seed) * 0x9E3779B1U;
+	hash = (hash ^ deviceID) * 0x85EBCA77U;
+	hash = (hash ^ variant) * 0xC2B2AE3DU;
+	return hash ^ (hash >> 16);
+}
+
+void checkChipTable(uint32 sourceHash) {
+	char msg[256];
+	uint32 i, j;
+	if ( sizeof(flashChips) / sizeof(flashChips[0]) != NUM_CHIPS ) {
+		throw GordonException("checkChipTable(): The table and its index have different sizes");
+	}
+	if ( sourceHash != CHIP_TABLE_SOURCE ) {
+		throw GordonException(
+			"checkChipTable(): The table was generated from a different gordon_chips.def; run \"make table\""
+		);
+	}
+	for ( i = 0; i < NUM_CHIPS; i++ ) {
+		const FlashChip *const thisChip = flashChips + i;
+		const FlashChip *primary = NULL;
+		for ( j = 0; j < NUM_CHIPS; j++ ) {
+			const FlashChip *const other = flashChips + j;
+			if ( other->vendorID != thisChip->vendorID || other->deviceID != thisChip->deviceID ) {
+				continue;
+			}
+			if ( j < i && other->variant == thisChip->variant ) {
+				sprintf(
+					msg, "checkChipTable(): Duplicate table entry for %s %s (variant %u)",
+					thisChip->vendorName, thisChip->deviceName, thisChip->variant
+				);
+				throw GordonException(msg);
+			}
+			if ( !other->variant ) {
+				primary = other;
+			}
+		}
+		if ( !primary || !primary->selectorFunc || (thisChip->variant && primary->selectorFunc == nullSelector) ) {
+			sprintf(
+				msg, "checkChipTable(): Table entry for %s %s (variant %u) has no usable selector",
+				thisChip->vendorName, thisChip->deviceName, thisChip->variant
+			);
+			throw GordonException(msg);
+		}
+		if ( lookupChip(thisChip->vendorID, thisChip->deviceID, thisChip->variant) != thisChip ) {
+			sprintf(
+				msg, "checkChipTable(): Table entry for %s %s (variant %u) is not in the index",
+				thisChip->vendorName, thisChip->deviceName, thisChip->variant
+			);
+			throw GordonException(msg);
+		}
+	}
+}
+
+const FlashChip *lookupChip(uint32 vendorID, uint32 deviceID, uint32 variant) {
+	const uint32 seed = chipSeeds[chipHash(vendorID, deviceID, variant, 0) % NUM_CHIP_BUCKETS];
+	const FlashChip *const thisChip =
+		flashChips + chipSlots[chipHash(vendorID, deviceID, variant, seed) % NUM_CHIPS];
+	if ( thisChip->vendorID == vendorID && thisChip->deviceID == deviceID && thisChip->variant == variant ) {
+		return thisChip;
+	}
+	return NULL;
+}
+
+void readChipIds(const Transport *transport, uint32 *vendorID, uint32 *deviceID) {
 	const uint8 readIdent = 0x9F;  // JEDEC ID command
-	const FlashChip *thisChip = flashChips;
-	uint8 buf[256];
+	uint8 buf[16];  // room for a dummy byte, several continuation codes and the IDs
 	const uint8 *ptr = buf;
-	uint32 vendorID = 0;
-	uint32 deviceID;
-	transport->sendMessage(&readIdent, 1, buf, 256);
-	while ( *ptr == 0x7F ) {
-		vendorID |= 0x7F;
-		vendorID <<= 8;
+	const uint8 *const end = buf + sizeof(buf) - 2;
+	uint32 id = 0;
+	transport->sendMessage(&readIdent, 1, buf, sizeof(buf));
+	if ( *ptr == 0x00 || *ptr == 0xFF ) {
+		// SPI NAND parts clock out a dummy byte before the manufacturer ID
+		ptr++;
+	}
+	while ( *ptr == 0x7F && ptr < end ) {
+		id |= 0x7F;
+		id <<= 8;
 		ptr++;
 	}
-	vendorID |= *ptr++;
-	deviceID = (ptr[0] << 8) | ptr[1];
-	while ( thisChip->deviceName && (thisChip->vendorID != vendorID || thisChip->deviceID != deviceID) ) {
-		thisChip++;
+	id |= *ptr++;
+	*vendorID = id;
+	*deviceID = (ptr[0] << 8) | ptr[1];
+}
+
+const FlashChip *findChip(
+	const Transport *transport, uint32 vendorID, uint32 deviceID, SfdpTables *sfdp)
+{
+	const FlashChip *thisChip = lookupChip(vendorID, deviceID, 0);
+	SfdpTables tables;
+	if ( thisChip ) {
+		const uint32 variant = thisChip->selectorFunc(transport);
+		if ( variant ) {
+			thisChip = lookupChip(vendorID, deviceID, variant);
+		}
+		if ( thisChip ) {
+			return thisChip;
+		}
+		char msg[256];
+		sprintf(msg, "findChip(): Unsupported variant %u of device: vendorID = 0x%08X, deviceID = 0x%04X", variant, vendorID, deviceID);
+		throw GordonException(msg);
+	}
+	if ( !sfdp ) {
+		sfdp = &tables;
 	}
-	if ( thisChip->vendorID == vendorID && thisChip->deviceID == deviceID ) {
-		thisChip += thisChip->selectorFunc(transport);
+	thisChip = readSfdpTables(transport, sfdp) ? sfdpChip(vendorID, deviceID, sfdp) : NULL;
+	if ( thisChip ) {
 		return thisChip;
 	} else {
 		char msg[256];
@@ -338,3 +961,9 @@ const FlashChip *findChip(const Transport *transport) {
 		throw GordonException(msg);
 	}
 }
+
+const FlashChip *findChip(const Transport *transport) {
+	uint32 vendorID, deviceID;
+	readChipIds(transport, &vendorID, &deviceID);
+	return findChip(transport, vendorID, deviceID, NULL);
+}
@@ -25,6 +25,14 @@
 //
 #define NUM_ERASEREGIONS 5
 
+// Unique IDs are at most this many bytes long.
+//
+#define MAX_UNIQUEID 64
+
+// SFDP parameter tables are read up to this many DWORDs long.
+//
+#define SFDP_MAX_DWORDS 23
+
 // Forward declarations
 //
 class Transport;
@@ -33,7 +41,7 @@ struct FlashChip;
 // Erase function type: erase the region containing the flash address "address".
 //
 typedef void (*BlockEraseFunc)(
-	const FlashChip *flashChip, const Transport *transport, uint32 address
+	const FlashChip *flashChip, const Transport *transport, uint64 address
 );
 
 // Page-program function type: write "length" bytes (guaranteed fewer than the
@@ -42,7 +50,27 @@ typedef void (*BlockEraseFunc)(
 //
 typedef void (*PageProgramFunc)(
 	const FlashChip *flashChip, const Transport *transport,
-	uint32 address, uint32 length, const uint8 *data
+	uint64 address, uint32 length, const uint8 *data
+);
+
+// Page-patch function type: overwrite "length" bytes at flash address "address"
+// (which need not be page-aligned, but the bytes must not cross the end of the
+// page) with the data pointed to by "data", leaving the rest of the page as it
+// was. Chips which can do this on-chip use it for unaligned and partial pages.
+//
+typedef void (*PagePatchFunc)(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data
+);
+
+// Page-verify function type: compare "length" bytes (guaranteed fewer than the
+// page-length) from the data pointed to by "data" with the contents of the
+// page at flash address "address" (which is guaranteed to be page-aligned),
+// without reading the page back. Returns true if they match.
+//
+typedef bool (*PageVerifyFunc)(
+	const FlashChip *flashChip, const Transport *transport,
+	uint64 address, uint32 length, const uint8 *data
 );
 
 // Data readback function type: read "length" bytes from address "address" and
@@ -50,19 +78,50 @@ typedef void (*PageProgramFunc)(
 //
 typedef void (*ReadFunc)(
 	const FlashChip *flashChip, const Transport *transport,
-	uint32 address, uint32 length, uint8 *buffer
+	uint64 address, uint32 length, uint8 *buffer
+);
+
+// Bad-block function type: returns true if the erase block at flash address
+// "address" (which is guaranteed to be block-aligned) is marked bad. This is
+// used for SPI NAND chips, whose blocks may be bad from the factory.
+//
+typedef bool (*BadBlockFunc)(
+	const FlashChip *flashChip, const Transport *transport, uint64 address
 );
 
 // Family selector function type. This is used where the configuration of a chip
 // affects its parameters, e.g chips whose page length can be configured to be a
 // power of two or slightly bigger - it affects the overall capacity. So the
-// idea is to have several configs for such chips, and the return value of this
-// function provides an index to select between them.
+// idea is to have several configs for such chips, each with the same IDs but a
+// different variant number, and the return value of this function (installed in
+// variant zero) is the variant number of the config to use.
 //
 typedef uint32 (*SelectorFunc)(
 	const Transport *transport
 );
 
+// Wait function type: wait for any operation still in progress on the chip to
+// complete.
+//
+typedef void (*WaitFunc)(
+	const FlashChip *flashChip, const Transport *transport
+);
+
+// Busy function type: returns true whilst an operation started on the chip at
+// flash address "address" is still in progress, and throws if it failed.
+//
+typedef bool (*BusyFunc)(
+	const FlashChip *flashChip, const Transport *transport, uint64 address
+);
+
+// Unique-ID function type: read the chip's factory-programmed unique ID into the
+// supplied buffer (which has room for MAX_UNIQUEID bytes), returning its length.
+// It is installed in variant zero, and must not depend on the variant.
+//
+typedef uint32 (*UniqueIdFunc)(
+	const Transport *transport, uint8 *buffer
+);
+
 // Each region has a size and a count, so a chip split into eight 64KiB chunks
 // has just one {64KiB, 8} region.
 //
@@ -71,6 +130,43 @@ struct EraseRegions {
 	uint32 count;
 };
 
+// Mode function type: put the chip into the mode needed by its erase, program
+// and read functions, or restore its default mode afterwards. This is used
+// e.g for chips bigger than 16MiB which only offer 4-byte addressing as a mode,
+// rather than as dedicated opcodes.
+//
+typedef void (*ModeFunc)(
+	const FlashChip *flashChip, const Transport *transport
+);
+
+// Some chips (e.g Atmel DataFlash) have a combined erase-and-program command
+// which is convenient for small writes, but which makes every page pay for its
+// own erase. Such chips can usually also erase a block of several pages in one
+// go, and then program each page of the block without the built-in erase. The
+// BulkWrite struct describes this alternative mechanism. The RegionProgrammer
+// uses it for blocks that are entirely covered by the data being written, and
+// falls back to the regular per-page mechanism for the rest.
+//
+struct BulkWrite {
+	uint32 blockPages;                // number of pages in each bulk-erasable block
+	BlockEraseFunc blockEraseFunc;    // erase the whole block containing "address"
+	PageProgramFunc pageProgramFunc;  // program a page within an erased block
+	WaitFunc waitFunc;                // wait for the final page program to complete
+};
+
+// Some chips (e.g most big NOR parts) can suspend an erase which is in progress,
+// allowing reads from elsewhere in the array, and then resume it. The
+// EraseSuspend struct describes this mechanism. The RegionProgrammer uses it to
+// service priority reads which arrive mid-erase, rather than making them wait
+// for an erase which may take hundreds of milliseconds.
+//
+struct EraseSuspend {
+	BlockEraseFunc startFunc;  // start erasing the region containing "address"
+	BusyFunc busyFunc;         // returns true whilst the erase is in progress
+	ModeFunc suspendFunc;      // suspend the erase, waiting until reads are allowed
+	ModeFunc resumeFunc;       // resume the suspended erase
+};
+
 // Each flash chip gets a descriptor described by this struct, allowing many
 // disparate flash chips to be handled by the same API.
 //
@@ -82,6 +178,7 @@ struct FlashChip {
 	const char *deviceName;
 	uint32 vendorID;
 	uint32 deviceID;
+	uint32 variant;
 	uint32 kbCapacity;
 	uint32 pageSize;
 	uint32 bitShift;
@@ -90,11 +187,58 @@ struct FlashChip {
 	PageProgramFunc pageProgramFunc;
 	ReadFunc readFunc;
 	SelectorFunc selectorFunc;
+	const BulkWrite *bulkWrite;
+	PageVerifyFunc pageVerifyFunc;
+	ModeFunc enterFunc;
+	ModeFunc exitFunc;
+	uint32 eraseTimeMs;      // typical time to erase one region, or zero if unknown
+	uint32 programTimeUs;    // typical time to program one page, or zero if unknown
+	BadBlockFunc badBlockFunc;
+	const EraseSuspend *eraseSuspend;
+	UniqueIdFunc uniqueIdFunc;
+	PagePatchFunc pagePatchFunc;
+};
+
+// The SFDP parameter tables from which a descriptor is built for chips which
+// are not in the table. A length of zero means the table is absent.
+//
+struct SfdpTables {
+	uint32 bfpt[SFDP_MAX_DWORDS];
+	uint32 bfptLength;
+	uint32 fourByte[SFDP_MAX_DWORDS];
+	uint32 fourByteLength;
 };
 
 // The public API: given a Transport, it queries the attached chip for its JEDEC
-// IDs, and finds the coresponding entry in the FlashChip table.
+// IDs, and finds the coresponding entry in the FlashChip table. If there is no
+// such entry, a descriptor is built at runtime from the chip's JEDEC SFDP table
+// (if it has one); such descriptors remain valid for the life of the process.
 //
 const FlashChip *findChip(const Transport *transport);
 
+// The same, broken into steps, for callers which remember chips from one session
+// to the next (see FlashDevice). The JEDEC IDs are read with readChipIds(), and
+// the chip is then found with findChip(), which copies the SFDP tables into
+// "sfdp" (if not NULL) when it builds a descriptor from them. A chip seen before
+// can be rebuilt without probing it again: table entries with lookupChip()
+// (which returns NULL if there is no such entry) and the rest with sfdpChip()
+// (which returns NULL if the tables describe a chip which cannot be driven).
+//
+void readChipIds(const Transport *transport, uint32 *vendorID, uint32 *deviceID);
+const FlashChip *findChip(
+	const Transport *transport, uint32 vendorID, uint32 deviceID, SfdpTables *sfdp
+);
+const FlashChip *lookupChip(uint32 vendorID, uint32 deviceID, uint32 variant);
+bool readSfdpTables(const Transport *transport, SfdpTables *tables);
+const FlashChip *sfdpChip(uint32 vendorID, uint32 deviceID, const SfdpTables *tables);
+
+// Check the generated FlashChip table: it must have been generated from the
+// gordon_chips.def whose FNV-1a hash is sourceHash, every entry's IDs and
+// variant must be unique and found by lookupChip(), and every family of
+// variants must have a selector in variant zero. Throws on the first problem
+// found. This is run at build time (see chipcheck), not by the programmer
+// itself.
+//
+void checkChipTable(uint32 sourceHash);
+
 #endif
@@ -0,0 +1,515 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "transport.h"
+#include "flash_device.h"
+#include "region_programmer.h"
+#include "shadow_image.h"
+#include "flash_manifest.h"
+#include "previous_image.h"
+#include "write_planner.h"
+#include "write_journal.h"
+#include "composite_image.h"
+#include "file_loader.h"
+#include "read_cache.h"
+#include "exception.h"
+#include "hash.h"
+#include "util.h"
+#include "sync.h"
+
+#define MAX_CACHELINE 1024
+#define SHADOW_SAMPLES 4
+#define PREVIOUS_SAMPLES 8
+#define PLAN_PROBE 0x10000
+#define CACHE_CHUNK 0x1000
+#define CACHE_CHUNKS 64
+#define CACHE_READAHEAD 16
+
+using namespace std;
+
+// Every FlashDevice in the process shares the cache file, and chips written at
+// the same time (see parallelWrite()) each save to it when they finish, so each
+// read-and-rewrite of the file is done under this lock.
+static Mutex cacheMutex;
+
+FlashDevice::FlashDevice(const Transport *transport, const char *cacheFile) :
+	m_transport(transport), m_useShadow(false), m_programmer(NULL), m_cache(NULL), m_shadow(NULL), m_manifest(NULL), m_previous(NULL), m_journal(NULL), m_verify(false)
+{
+	const FlashChip *thisChip = NULL;
+	bool shadowKey = false;
+	uint32 vendorID, deviceID;
+	m_sfdp.bfptLength = 0;
+	m_sfdp.fourByteLength = 0;
+	readChipIds(m_transport, &vendorID, &deviceID);
+	if ( cacheFile ) {
+		const FlashChip *const primary = lookupChip(vendorID, deviceID, 0);
+		uint32 uidLength;
+		const string key = chipKey(vendorID, deviceID, &uidLength);
+		if ( uidLength || !primary || !lookupChip(vendorID, deviceID, 1) ) {
+			m_cacheFile = cacheFile;
+			m_cacheKey = key;
+			shadowKey = (uidLength != 0);
+			thisChip = loadCache(vendorID, deviceID);
+		}
+	}
+	if ( thisChip ) {
+		m_programmer = new RegionProgrammer(m_transport, &m_chip);
+	} else {
+		m_chip = *findChip(m_transport, vendorID, deviceID, &m_sfdp);
+		m_programmer = new RegionProgrammer(m_transport, &m_chip);
+		saveCache();
+	}
+	m_cache = new ReadCache(
+		m_programmer, (uint64)1024 * m_chip.kbCapacity,
+		(m_chip.pageSize > CACHE_CHUNK) ? m_chip.pageSize : CACHE_CHUNK, CACHE_CHUNKS, CACHE_READAHEAD
+	);
+	if ( shadowKey ) {
+		m_shadowFile = m_cacheFile + "." + m_cacheKey;
+		for ( string::iterator it = m_shadowFile.begin() + m_cacheFile.length(); it != m_shadowFile.end(); ++it ) {
+			if ( *it == ':' ) {
+				*it = '-';
+			}
+		}
+	}
+}
+
+FlashDevice::~FlashDevice() {
+	delete m_cache;
+	delete m_programmer;
+	delete m_shadow;
+	delete m_manifest;
+	delete m_previous;
+	delete m_journal;
+}
+
+// The chip's JEDEC IDs and, where it has one, its unique ID, whose length is
+// returned in "uidLength".
+string FlashDevice::chipKey(uint32 vendorID, uint32 deviceID, uint32 *uidLength) const {
+	const FlashChip *const primary = lookupChip(vendorID, deviceID, 0);
+	uint8 uniqueID[MAX_UNIQUEID];
+	char key[32 + 2 * MAX_UNIQUEID];
+	char *ptr = key + sprintf(key, "%08X:%04X", vendorID, deviceID);
+	uint32 i;
+	*uidLength = 0;
+	if ( primary && primary->uniqueIdFunc ) {
+		*uidLength = primary->uniqueIdFunc(m_transport, uniqueID);
+		for ( i = 1; i < *uidLength && uniqueID[i] == uniqueID[0]; i++ );
+		if ( i == *uidLength && (uniqueID[0] == 0x00 || uniqueID[0] == 0xFF) ) {
+			*uidLength = 0;  // blank, so not really a unique ID
+		}
+	}
+	for ( i = 0; i < *uidLength; i++ ) {
+		ptr += sprintf(ptr, i ? "%02X" : ":%02X", uniqueID[i]);
+	}
+	return key;
+}
+
+void FlashDevice::useJournal(const char *fileName, bool resume) {
+	uint32 uidLength;
+	WriteJournal *const journal = new WriteJournal(
+		fileName, chipKey(m_chip.vendorID, m_chip.deviceID, &uidLength), resume
+	);
+	delete m_journal;
+	m_journal = journal;
+}
+
+bool FlashDevice::useManifest(uint64 address) {
+	vector<uint8> slots;
+	bool found;
+	FlashManifest *manifest;
+	if ( m_previous ) {
+		throw GordonException("FlashDevice::useManifest(): A manifest cannot be combined with a previous image!");
+	}
+	manifest = new FlashManifest(&m_chip, address);
+	delete m_manifest;
+	m_manifest = manifest;
+	slots.resize(2 * (size_t)m_manifest->size());
+	m_programmer->read(m_manifest->slotAddress(0), m_manifest->size(), &slots[0]);
+	m_programmer->read(m_manifest->slotAddress(1), m_manifest->size(), &slots[m_manifest->size()]);
+	found = m_manifest->load(&slots[0], &slots[m_manifest->size()]);
+	dropShadow();
+	m_programmer->setBaseline(m_manifest);
+	return found;
+}
+
+bool FlashDevice::usePrevious(uint64 address, uint64 length, const uint8 *data) {
+	if ( m_manifest ) {
+		throw GordonException("FlashDevice::usePrevious(): A previous image cannot be combined with a manifest!");
+	}
+	PreviousImage *const previous = new PreviousImage(&m_chip, address, length, data);
+	delete m_previous;
+	m_previous = previous;
+	dropShadow();
+	m_programmer->setBaseline(m_previous);
+	return m_programmer->checkBaseline(PREVIOUS_SAMPLES);
+}
+
+bool FlashDevice::useShadow() {
+	if ( m_shadowFile.empty() ) {
+		return false;
+	}
+	m_useShadow = !m_manifest && !m_previous;
+	return true;
+}
+
+// Load the shadow image, if one is wanted and not yet loaded, and check it.
+void FlashDevice::loadShadow() {
+	if ( m_useShadow && !m_shadow ) {
+		m_shadow = new ShadowImage(m_shadowFile.c_str(), &m_chip);
+		m_programmer->setBaseline(m_shadow);
+		if ( !m_programmer->checkBaseline(SHADOW_SAMPLES) ) {
+			printf("The flash does not match its shadow image; discarding it\n");
+		}
+	}
+}
+
+// The shadow would not see writes made with another baseline, so stop using it;
+// its file is removed by the next write.
+void FlashDevice::dropShadow() {
+	delete m_shadow;
+	m_shadow = NULL;
+	m_useShadow = false;
+}
+
+// The baseline in use, if any.
+FlashBaseline *FlashDevice::baseline() const {
+	if ( m_manifest ) {
+		return m_manifest;
+	} else if ( m_previous ) {
+		return m_previous;
+	} else {
+		return m_shadow;
+	}
+}
+
+// Write the manifest to its next slot, making it the current copy.
+void FlashDevice::commitManifest() {
+	vector<uint8> buffer;
+	uint64 slotAddress;
+	m_manifest->prepare(buffer, &slotAddress);
+	m_programmer->write(slotAddress, buffer.size(), &buffer[0]);
+	m_manifest->committed();
+}
+
+// Look for the chip in the cache file, returning its descriptor (with any
+// observed times applied), or NULL if there is no usable entry.
+const FlashChip *FlashDevice::loadCache(uint32 vendorID, uint32 deviceID) {
+	const size_t keyLength = m_cacheKey.length();
+	char line[MAX_CACHELINE];
+	const FlashChip *thisChip = NULL;
+	LockJanitor lock(cacheMutex);
+	FILE *const file = fopen(m_cacheFile.c_str(), "r");
+	if ( !file ) {
+		return NULL;
+	}
+	while ( fgets(line, MAX_CACHELINE, file) ) {
+		const char *ptr = line + keyLength;
+		char *end;
+		uint32 eraseTimeMs, programTimeUs, i;
+		bool isSfdp = false;
+		unsigned long variant = 0;
+		if ( strncmp(line, m_cacheKey.c_str(), keyLength) || *ptr != ' ' ) {
+			continue;
+		}
+		if ( startsWith(ptr, " sfdp ") ) {
+			isSfdp = true;
+			ptr += 5;
+		} else {
+			variant = strtoul(ptr, &end, 10);
+			ptr = end;
+		}
+		eraseTimeMs = (uint32)strtoul(ptr, &end, 10);
+		programTimeUs = (uint32)strtoul(end, &end, 10);
+		ptr = end;
+		if ( isSfdp ) {
+			m_sfdp.bfptLength = (uint32)strtoul(ptr, &end, 10);
+			for ( i = 0; i < m_sfdp.bfptLength && i < SFDP_MAX_DWORDS; i++ ) {
+				m_sfdp.bfpt[i] = (uint32)strtoul(end, &end, 16);
+			}
+			m_sfdp.fourByteLength = (uint32)strtoul(end, &end, 10);
+			for ( i = 0; i < m_sfdp.fourByteLength && i < SFDP_MAX_DWORDS; i++ ) {
+				m_sfdp.fourByte[i] = (uint32)strtoul(end, &end, 16);
+			}
+			if ( m_sfdp.bfptLength <= SFDP_MAX_DWORDS && m_sfdp.fourByteLength <= SFDP_MAX_DWORDS ) {
+				thisChip = sfdpChip(vendorID, deviceID, &m_sfdp);
+			}
+			if ( !thisChip ) {
+				m_sfdp.bfptLength = 0;
+				m_sfdp.fourByteLength = 0;
+			}
+		} else {
+			thisChip = lookupChip(vendorID, deviceID, (uint32)variant);
+		}
+		if ( thisChip && (*end == '\n' || *end == '\0') ) {
+			m_chip = *thisChip;
+			if ( eraseTimeMs ) {
+				m_chip.eraseTimeMs = eraseTimeMs;
+			}
+			if ( programTimeUs ) {
+				m_chip.programTimeUs = programTimeUs;
+			}
+		} else {
+			thisChip = NULL;  // stale or damaged, so detect afresh and overwrite it
+		}
+		break;
+	}
+	fclose(file);
+	return thisChip;
+}
+
+// Save this chip's entry in the cache file, keeping the entries for all the
+// other chips. The cache is only an optimisation, so failure is just a warning.
+void FlashDevice::saveCache() const {
+	vector<string> lines;
+	char line[MAX_CACHELINE];
+	char *ptr = line;
+	uint32 i;
+	if ( m_cacheKey.empty() ) {
+		return;
+	}
+	LockJanitor lock(cacheMutex);
+	FILE *file = fopen(m_cacheFile.c_str(), "r");
+	if ( file ) {
+		while ( fgets(line, MAX_CACHELINE, file) ) {
+			if ( strncmp(line, m_cacheKey.c_str(), m_cacheKey.length()) || line[m_cacheKey.length()] != ' ' ) {
+				lines.push_back(line);
+			}
+		}
+		fclose(file);
+	}
+	ptr += sprintf(ptr, "%s ", m_cacheKey.c_str());
+	if ( m_sfdp.bfptLength ) {
+		ptr += sprintf(ptr, "sfdp %u %u %u", m_chip.eraseTimeMs, m_chip.programTimeUs, m_sfdp.bfptLength);
+		for ( i = 0; i < m_sfdp.bfptLength; i++ ) {
+			ptr += sprintf(ptr, " %08X", m_sfdp.bfpt[i]);
+		}
+		ptr += sprintf(ptr, " %u", m_sfdp.fourByteLength);
+		for ( i = 0; i < m_sfdp.fourByteLength; i++ ) {
+			ptr += sprintf(ptr, " %08X", m_sfdp.fourByte[i]);
+		}
+	} else {
+		ptr += sprintf(ptr, "%u %u %u", m_chip.variant, m_chip.eraseTimeMs, m_chip.programTimeUs);
+	}
+	sprintf(ptr, "\n");
+	lines.push_back(line);
+	file = fopen(m_cacheFile.c_str(), "w");
+	if ( !file ) {
+		fprintf(stderr, "Warning: unable to write chip cache %s\n", m_cacheFile.c_str());
+		return;
+	}
+	for ( vector<string>::const_iterator it = lines.begin(); it != lines.end(); ++it ) {
+		fputs(it->c_str(), file);
+	}
+	fclose(file);
+}
+
+// Writes must not overlap the manifest.
+void FlashDevice::checkManifest(uint64 address, uint64 length) const {
+	const uint64 manifestEnd = m_manifest->address() + m_manifest->length();
+	if ( address < manifestEnd && m_manifest->address() < address + length ) {
+		char msg[256];
+		sprintf(
+			msg,
+			"FlashDevice::write(): The data overlaps the manifest at 0x%08llX-0x%08llX!",
+			(unsigned long long)m_manifest->address(), (unsigned long long)(manifestEnd - 1)
+		);
+		throw GordonException(msg);
+	}
+}
+
+// Write with the manifest: commit a copy without the regions which will change,
+// write them, then commit a copy with their new hashes. The image recorded is
+// the runs written, each with its own CRC-32C.
+void FlashDevice::writeManifested(const vector<ImageRun> &runs) {
+	vector<ManifestImage> images(runs.size());
+	vector<ImageRun>::const_iterator it;
+	uint32 numChanged = 0;
+	size_t i;
+	if ( runs.size() > MANIFEST_MAX_IMAGES ) {
+		char msg[256];
+		sprintf(
+			msg, "FlashDevice::write(): The manifest can record at most %u runs, not %u!",
+			MANIFEST_MAX_IMAGES, (uint32)runs.size()
+		);
+		throw GordonException(msg);
+	}
+	for ( it = runs.begin(), i = 0; it != runs.end(); ++it, i++ ) {
+		checkManifest(it->address, it->length);
+		images[i].address = it->address;
+		images[i].length = it->length;
+		images[i].crc = crc32c(0, it->data, (size_t)it->length);
+		numChanged += m_manifest->forgetChanges(it->address, it->length, it->data);
+	}
+	const vector<ManifestImage> &recorded = m_manifest->images();
+	bool same = (recorded.size() == images.size());
+	for ( i = 0; same && i < images.size(); i++ ) {
+		same =
+			recorded[i].address == images[i].address && recorded[i].length == images[i].length &&
+			recorded[i].crc == images[i].crc;
+	}
+	if ( !numChanged ) {
+		printf("The flash already holds this data; nothing to write\n");
+		if ( !same ) {
+			m_manifest->setImages(images);
+			commitManifest();
+		}
+		return;
+	}
+	commitManifest();
+	for ( it = runs.begin(); it != runs.end(); ++it ) {
+		m_programmer->write(it->address, it->length, it->data, m_journal);
+	}
+	m_manifest->setImages(images);
+	commitManifest();
+}
+
+void FlashDevice::writeRuns(const vector<ImageRun> &runs) {
+	if ( runs.empty() ) {
+		return;
+	}
+	m_cache->clear();
+	loadShadow();
+	if ( !m_shadow && !m_shadowFile.empty() ) {
+		remove(m_shadowFile.c_str());
+	}
+	try {
+		if ( m_manifest ) {
+			writeManifested(runs);
+		} else {
+			for ( vector<ImageRun>::const_iterator it = runs.begin(); it != runs.end(); ++it ) {
+				m_programmer->write(it->address, it->length, it->data, m_journal);
+			}
+		}
+	}
+	catch ( ... ) {
+		if ( m_shadow ) {
+			m_shadow->save();  // it knows which regions were left in an unknown state
+		}
+		throw;
+	}
+	if ( m_shadow ) {
+		m_shadow->save();
+	}
+	if ( m_journal ) {
+		m_journal->finish();
+	}
+	if ( m_programmer->eraseTimeMs() ) {
+		m_chip.eraseTimeMs = m_programmer->eraseTimeMs();
+	}
+	if ( m_programmer->programTimeUs() ) {
+		m_chip.programTimeUs = m_programmer->programTimeUs();
+	}
+	saveCache();
+}
+
+void FlashDevice::write(uint64 address, uint64 length, const uint8 *data) {
+	ImageRun run;
+	run.address = address;
+	run.length = length;
+	run.data = data;
+	writeRuns(vector<ImageRun>(1, run));
+}
+
+void FlashDevice::write(const CompositeImage &image) {
+	writeRuns(image.runs());
+}
+
+void FlashDevice::write(uint64 address, FileLoader &loader) {
+	if ( m_manifest || m_journal ) {
+		loader.waitFor(loader.length());  // they hash all of the data up front
+	}
+	m_programmer->setLoader(&loader);
+	try {
+		write(address, loader.length(), loader.data());
+	}
+	catch ( ... ) {
+		m_programmer->setLoader(NULL);
+		throw;
+	}
+	m_programmer->setLoader(NULL);
+}
+
+void FlashDevice::read(uint64 address, uint64 length, uint8 *buffer) {
+	m_cache->read(address, length, buffer);
+}
+
+void FlashDevice::verify(uint64 address, uint64 length, const uint8 *data) {
+	m_programmer->verify(address, length, data);
+}
+
+void FlashDevice::sampledVerify(
+	uint64 address, uint64 length, const uint8 *data, uint32 numRandom, bool escalate)
+{
+	m_programmer->sampledVerify(address, length, data, numRandom, escalate);
+}
+
+bool FlashDevice::priorityRead(uint64 address, uint64 length, uint8 *buffer) {
+	return m_programmer->priorityRead(address, length, buffer);
+}
+
+void FlashDevice::setVerify(bool verify) {
+	m_verify = verify;
+	m_programmer->setVerify(verify);
+}
+
+void FlashDevice::digest(
+	uint64 address, uint64 length, std::vector<RegionDigest> &regions, uint32 *crc, uint8 *sha256)
+{
+	m_programmer->digest(address, length, regions, crc, sha256);
+}
+
+void FlashDevice::planRuns(const vector<ImageRun> &runs, WritePlan &plan) {
+	loadShadow();
+	WritePlanner planner(&m_chip, baseline(), m_verify);
+	const uint32 eraseCount = plan.eraseCount, pageCount = plan.pageCount;
+	const uint64 capacity = (uint64)1024 * m_chip.kbCapacity;
+	vector<ImageRun>::const_iterator it;
+	for ( it = runs.begin(); it != runs.end(); ++it ) {
+		if ( m_manifest ) {
+			checkManifest(it->address, it->length);
+		}
+		planner.plan(it->address, it->length, it->data, plan);
+	}
+	if ( m_manifest && (plan.eraseCount != eraseCount || plan.pageCount != pageCount) ) {
+		// A copy of the manifest is committed before and after the write
+		vector<uint8> buffer;
+		uint64 slotAddress;
+		m_manifest->prepare(buffer, &slotAddress);
+		planner.plan(m_manifest->slotAddress(0), buffer.size(), &buffer[0], plan);
+		planner.plan(m_manifest->slotAddress(1), buffer.size(), &buffer[0], plan);
+	}
+	plan.eraseTimeMs = m_chip.eraseTimeMs;
+	plan.programTimeUs = m_chip.programTimeUs;
+	if ( !plan.bytesPerSecond ) {
+		plan.bytesPerSecond = m_programmer->readBytesPerSecond((uint32)((capacity < PLAN_PROBE) ? capacity : PLAN_PROBE));
+	}
+}
+
+void FlashDevice::plan(uint64 address, uint64 length, const uint8 *data, WritePlan &plan) {
+	ImageRun run;
+	run.address = address;
+	run.length = length;
+	run.data = data;
+	planRuns(vector<ImageRun>(1, run), plan);
+}
+
+void FlashDevice::plan(const CompositeImage &image, WritePlan &plan) {
+	planRuns(image.runs(), plan);
+}
@@ -0,0 +1,154 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef FLASH_DEVICE_H
+#define FLASH_DEVICE_H
+
+#include <string>
+#include <vector>
+#include "flash_chips.h"
+
+// Forward-declarations
+//
+class Transport;
+class RegionProgrammer;
+struct RegionDigest;
+class ShadowImage;
+class FlashManifest;
+class PreviousImage;
+class FlashBaseline;
+struct WritePlan;
+class WriteJournal;
+struct ImageRun;
+class CompositeImage;
+class FileLoader;
+class ReadCache;
+
+// A FlashDevice is the flash chip attached to a Transport, for the duration of a
+// session. The chip is detected once, on construction, and all the session's
+// reads and writes then share the resulting descriptor.
+//
+// Given a cache file, the outcome of detection is remembered from one session
+// to the next. Entries are keyed by the chip's JEDEC IDs and, where it has one,
+// its factory-programmed unique ID, so later sessions skip the selector and SFDP
+// probes. Chips whose configuration can differ between boards (i.e those with
+// variants) are only cached if they have a unique ID. Each entry also keeps the
+// erase and program times observed on the chip, which replace the typical
+// times given by its descriptor.
+//
+// Chips with a unique ID may also have a shadow image: a copy of their contents
+// kept alongside the cache file, so writes can skip the regions which would not
+// change without reading anything back. It is loaded on the first write, when a
+// few of its pages are checked against the flash, and if any differ (e.g because
+// another tool has written the flash) it is discarded. A write made without the
+// shadow removes its file, as it would no longer be right.
+//
+// Alternatively, the session can use a manifest kept on the flash itself (see
+// FlashManifest), which serves the same purpose but stays right whichever host
+// writes the board. Writes which would change nothing then write nothing at all.
+// Or, for delta updates, the caller can supply the image last written.
+//
+// Writes may also keep a journal of their progress (see WriteJournal), so one
+// which is interrupted can be resumed by a later session.
+//
+// Small reads go through a ReadCache, so callers may read a header at a time
+// without each read costing a trip over the link. The cache is cleared whenever
+// the flash is written.
+//
+class FlashDevice {
+	const Transport *const m_transport;
+	FlashChip m_chip;
+	SfdpTables m_sfdp;
+	std::string m_cacheFile;
+	std::string m_cacheKey;
+	std::string m_shadowFile;
+	bool m_useShadow;
+	RegionProgrammer *m_programmer;
+	ReadCache *m_cache;
+	ShadowImage *m_shadow;
+	FlashManifest *m_manifest;
+	PreviousImage *m_previous;
+	WriteJournal *m_journal;
+	bool m_verify;
+	FlashDevice &operator=(const FlashDevice &other);
+	FlashDevice(const FlashDevice &other);
+	std::string chipKey(uint32 vendorID, uint32 deviceID, uint32 *uidLength) const;
+	const FlashChip *loadCache(uint32 vendorID, uint32 deviceID);
+	void saveCache() const;
+	void commitManifest();
+	void loadShadow();
+	void dropShadow();
+	FlashBaseline *baseline() const;
+	void checkManifest(uint64 address, uint64 length) const;
+	void writeManifested(const std::vector<ImageRun> &runs);
+	void writeRuns(const std::vector<ImageRun> &runs);
+	void planRuns(const std::vector<ImageRun> &runs, WritePlan &plan);
+public:
+	// Construction detects the chip, consulting the cache file (if not NULL).
+	explicit FlashDevice(const Transport *transport, const char *cacheFile = NULL);
+	~FlashDevice();
+
+	// The descriptor of the attached chip.
+	const FlashChip *chip() const { return &m_chip; }
+
+	// Keep a shadow image of the chip, if it has a unique ID and there is a cache
+	// file; returns false if not. Using a manifest or a previous image as well
+	// turns the shadow off.
+	bool useShadow();
+
+	// Use a manifest kept in two slots of whole erase regions starting at flash
+	// address "address", instead of any shadow image. Returns false if there was
+	// no valid manifest there yet, in which case the first write creates one.
+	bool useManifest(uint64 address);
+
+	// Delta updates: the flash holds the given image at "address", as written by
+	// an earlier write, so a write there need only touch the regions which differ.
+	// A few pages are read to confirm it; returns false if they do not match, in
+	// which case nothing is assumed. This cannot be combined with a manifest.
+	bool usePrevious(uint64 address, uint64 length, const uint8 *data);
+
+	// Keep a journal of each write's progress in the given file, deleting it once
+	// the write succeeds. If "resume" is set, a write which finds the journal left
+	// by an interrupted attempt at the same write to this chip carries on from
+	// where that attempt got to.
+	void useJournal(const char *fileName, bool resume);
+
+	// Public API: as for the RegionProgrammer. After a write, the times observed
+	// are saved in the cache file, and the shadow image or manifest is saved. A
+	// CompositeImage is written run by run, as one write. A file given by a
+	// FileLoader is written as it loads, unless the manifest or journal needs all
+	// of its data first. Reads small enough to be cached are not reported, and
+	// priority reads bypass the cache.
+	void write(uint64 address, uint64 length, const uint8 *data);
+	void write(const CompositeImage &image);
+	void write(uint64 address, FileLoader &loader);
+	void read(uint64 address, uint64 length, uint8 *buffer);
+	void verify(uint64 address, uint64 length, const uint8 *data);
+	void sampledVerify(uint64 address, uint64 length, const uint8 *data, uint32 numRandom, bool escalate);
+	bool priorityRead(uint64 address, uint64 length, uint8 *buffer);
+	void setVerify(bool verify);
+	void digest(
+		uint64 address, uint64 length, std::vector<RegionDigest> &regions, uint32 *crc, uint8 *sha256
+	);
+
+	// Dry run: add what write() would do to the plan, without touching the flash,
+	// along with the timings needed to estimate its duration. The link speed is
+	// measured with a short read.
+	void plan(uint64 address, uint64 length, const uint8 *data, WritePlan &plan);
+	void plan(const CompositeImage &image, WritePlan &plan);
+};
+
+#endif
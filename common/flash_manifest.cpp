@@ -0,0 +1,267 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstdio>
+#include <cstring>
+#include "exception.h"
+#include "flash_chips.h"
+#include "flash_manifest.h"
+#include "hash.h"
+#include "util.h"
+
+using namespace std;
+
+// Each copy of the manifest holds this header, then a CRC-32C for each erase
+// region, then a bitmap of the regions whose CRC is known, then a CRC-32C of
+// everything before it. The header ends with a table of MANIFEST_MAX_IMAGES
+// image runs, of which the first "numImages" are used. It is stored
+// little-endian, so any host can read it.
+//
+#define HDR_MAGIC      0
+#define HDR_SEQUENCE   8
+#define HDR_NUMREGIONS 12
+#define HDR_NUMIMAGES  16
+#define HDR_IMAGES     20
+#define IMG_ADDRESS    0
+#define IMG_BYTES      8
+#define IMG_CRC        16
+#define IMG_ENTRY      20
+#define HDR_LENGTH     (HDR_IMAGES + IMG_ENTRY * MANIFEST_MAX_IMAGES)
+static const char manifestMagic[8] = {'G', 'O', 'R', 'D', 'M', 'A', 'N', '2'};
+
+FlashManifest::FlashManifest(const FlashChip *flashChip, uint64 address) :
+	m_blockMap(flashChip),
+	m_sequence(0), m_slot(1)
+{
+	const size_t numRegions = (size_t)m_blockMap.numBlocks();
+	EraseBlockMap::const_iterator it = m_blockMap.lowerBound(address);
+	uint32 slot;
+	m_hashes.assign(numRegions, 0);
+	m_known.assign(numRegions, 0);
+	m_size = (uint32)(HDR_LENGTH + 4 * numRegions + (numRegions + 7) / 8 + 4);
+
+	// Each slot is as many whole regions as it takes to hold a copy
+	if ( it == m_blockMap.end() || it->address != address ) {
+		char msg[256];
+		sprintf(
+			msg,
+			"FlashManifest: The manifest must start at the start of an erase region, within the %u KiB of the chip!",
+			flashChip->kbCapacity
+		);
+		throw GordonException(msg);
+	}
+	m_slots[0] = address;
+	for ( slot = 1; slot < 3; slot++ ) {
+		while ( it != m_blockMap.end() && it->address < m_slots[slot - 1] + m_size ) {
+			++it;
+		}
+		m_slots[slot] = (it == m_blockMap.end()) ? m_blockMap.capacity() : it->address;
+		if ( m_slots[slot] < m_slots[slot - 1] + m_size ) {
+			char msg[256];
+			sprintf(
+				msg,
+				"FlashManifest: The manifest needs two slots of %u bytes, which do not fit between 0x%08llX and the end of the chip!",
+				m_size, (unsigned long long)address
+			);
+			throw GordonException(msg);
+		}
+	}
+}
+
+// Return true if the erase region with the given index is exactly the one given.
+bool FlashManifest::isRegion(size_t index, uint64 address, uint32 regionSize) const {
+	const EraseBlock block = m_blockMap.block(index);
+	return block.address == address && block.size == regionSize;
+}
+
+// The regions holding the manifest itself are never known.
+bool FlashManifest::reserved(size_t index) const {
+	const uint64 address = m_blockMap.block(index).address;
+	return address >= m_slots[0] && address < m_slots[2];
+}
+
+// The CRC-32C of a region holding "length" bytes of data, padded with 0xFF.
+uint32 FlashManifest::regionHash(uint32 regionSize, const uint8 *data, uint32 length) const {
+	static const uint32 blankSize = 256;
+	uint8 blank[blankSize];
+	uint32 crc = crc32c(0, data, length);
+	memset(blank, 0xFF, blankSize);
+	for ( regionSize -= length; regionSize > blankSize; regionSize -= blankSize ) {
+		crc = crc32c(crc, blank, blankSize);
+	}
+	return crc32c(crc, blank, regionSize);
+}
+
+bool FlashManifest::load(const uint8 *slot0, const uint8 *slot1) {
+	const uint8 *const slots[2] = {slot0, slot1};
+	const size_t numRegions = m_hashes.size();
+	const uint8 *copy = NULL;
+	uint32 slot, sequence = 0;
+	size_t i;
+	for ( slot = 0; slot < 2; slot++ ) {
+		const uint8 *const ptr = slots[slot];
+		if (
+			memcmp(ptr + HDR_MAGIC, manifestMagic, sizeof(manifestMagic)) ||
+			getLE32(ptr + HDR_NUMREGIONS) != numRegions ||
+			getLE32(ptr + HDR_NUMIMAGES) > MANIFEST_MAX_IMAGES ||
+			getLE32(ptr + m_size - 4) != crc32c(0, ptr, m_size - 4) )
+		{
+			continue;  // blank, torn or for a different chip
+		}
+		if ( !copy || (int32)(getLE32(ptr + HDR_SEQUENCE) - sequence) > 0 ) {
+			copy = ptr;
+			sequence = getLE32(ptr + HDR_SEQUENCE);
+			m_slot = slot;
+		}
+	}
+	if ( !copy ) {
+		return false;
+	}
+	m_sequence = sequence;
+	m_images.resize(getLE32(copy + HDR_NUMIMAGES));
+	for ( i = 0; i < m_images.size(); i++ ) {
+		const uint8 *const image = copy + HDR_IMAGES + IMG_ENTRY * i;
+		m_images[i].address = getLE64(image + IMG_ADDRESS);
+		m_images[i].length = getLE64(image + IMG_BYTES);
+		m_images[i].crc = getLE32(image + IMG_CRC);
+	}
+	for ( i = 0; i < numRegions; i++ ) {
+		m_hashes[i] = getLE32(copy + HDR_LENGTH + 4 * i);
+		m_known[i] = (copy[HDR_LENGTH + 4 * numRegions + i / 8] >> (i % 8)) & 1;
+		if ( reserved(i) ) {
+			m_known[i] = 0;
+		}
+	}
+	return true;
+}
+
+void FlashManifest::setImages(const vector<ManifestImage> &images) {
+	if ( images.size() > MANIFEST_MAX_IMAGES ) {
+		char msg[256];
+		sprintf(
+			msg, "FlashManifest: The manifest can record at most %u runs, not %u!",
+			MANIFEST_MAX_IMAGES, (uint32)images.size()
+		);
+		throw GordonException(msg);
+	}
+	m_images = images;
+}
+
+uint32 FlashManifest::forgetChanges(uint64 address, uint64 length, const uint8 *data) {
+	EraseBlockMap::const_iterator it, end;
+	uint32 count = 0;
+	if ( !length ) {
+		return 0;
+	}
+	it = m_blockMap.lowerBound(address);
+	if ( length > m_blockMap.capacity() || address > m_blockMap.capacity() - length || it->address != address ) {
+		forget(address, length);
+		return 1;  // not a write the RegionProgrammer can skip anyway
+	}
+	for ( end = m_blockMap.upperBound(address, length); it != end; ++it ) {
+		const uint32 bytesUsed = (length > it->size) ? it->size : (uint32)length;
+		if ( !matches(it->address, it->size, data, bytesUsed) ) {
+			m_known[(size_t)m_blockMap.blockIndex(it->address)] = 0;
+			count++;
+		}
+		data += bytesUsed;
+		length -= bytesUsed;
+	}
+	return count;
+}
+
+void FlashManifest::prepare(vector<uint8> &buffer, uint64 *slotAddress) const {
+	const size_t numRegions = m_hashes.size();
+	uint8 *ptr;
+	size_t i;
+	buffer.assign(m_size, 0x00);
+	ptr = &buffer[0];
+	memcpy(ptr + HDR_MAGIC, manifestMagic, sizeof(manifestMagic));
+	putLE32(ptr + HDR_SEQUENCE, m_sequence + 1);
+	putLE32(ptr + HDR_NUMREGIONS, (uint32)numRegions);
+	putLE32(ptr + HDR_NUMIMAGES, (uint32)m_images.size());
+	for ( i = 0; i < m_images.size(); i++ ) {
+		uint8 *const image = ptr + HDR_IMAGES + IMG_ENTRY * i;
+		putLE64(image + IMG_ADDRESS, m_images[i].address);
+		putLE64(image + IMG_BYTES, m_images[i].length);
+		putLE32(image + IMG_CRC, m_images[i].crc);
+	}
+	for ( i = 0; i < numRegions; i++ ) {
+		putLE32(ptr + HDR_LENGTH + 4 * i, m_hashes[i]);
+		if ( m_known[i] ) {
+			ptr[HDR_LENGTH + 4 * numRegions + i / 8] |= (uint8)(1 << (i % 8));
+		}
+	}
+	putLE32(ptr + m_size - 4, crc32c(0, ptr, m_size - 4));
+	*slotAddress = m_slots[m_slot ^ 1];
+}
+
+void FlashManifest::committed() {
+	m_sequence++;
+	m_slot ^= 1;
+}
+
+bool FlashManifest::matches(uint64 address, uint32 regionSize, const uint8 *data, uint32 length) {
+	size_t index;
+	if ( address >= m_blockMap.capacity() ) {
+		return false;
+	}
+	index = (size_t)m_blockMap.blockIndex(address);
+	return
+		m_known[index] && isRegion(index, address, regionSize) &&
+		m_hashes[index] == regionHash(regionSize, data, length);
+}
+
+bool FlashManifest::isErased(uint64 address, uint32 regionSize) {
+	return matches(address, regionSize, NULL, 0);
+}
+
+void FlashManifest::forget(uint64 address, uint64 length) {
+	EraseBlockMap::const_iterator it, end;
+	if ( address >= m_blockMap.capacity() || !length ) {
+		return;
+	}
+	if ( length > m_blockMap.capacity() - address ) {
+		length = m_blockMap.capacity() - address;
+	}
+	for ( it = m_blockMap.lowerBound(address), end = m_blockMap.upperBound(address, length); it != end; ++it ) {
+		m_known[(size_t)m_blockMap.blockIndex(it->address)] = 0;
+	}
+}
+
+void FlashManifest::update(uint64 address, uint32 regionSize, const uint8 *data, uint32 length) {
+	size_t index;
+	if ( address >= m_blockMap.capacity() ) {
+		return;
+	}
+	index = (size_t)m_blockMap.blockIndex(address);
+	if ( !isRegion(index, address, regionSize) ) {
+		forget(address, regionSize);
+	} else if ( !reserved(index) ) {
+		m_hashes[index] = regionHash(regionSize, data, length);
+		m_known[index] = 1;
+	}
+}
+
+// The manifest only holds hashes of whole regions, so there are no pages to
+// check; it is trusted because it is updated wherever the flash is.
+uint32 FlashManifest::samplePages(uint64 *, uint32) {
+	return 0;
+}
+
+bool FlashManifest::checkPage(uint64, const uint8 *) {
+	return true;
+}
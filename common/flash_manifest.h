@@ -0,0 +1,105 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef FLASH_MANIFEST_H
+#define FLASH_MANIFEST_H
+
+#include <vector>
+#include "flash_baseline.h"
+#include "erase_block_map.h"
+
+// Forward-declarations
+//
+struct FlashChip;
+
+// The manifest has room for this many runs of the last image written.
+//
+#define MANIFEST_MAX_IMAGES 16
+
+// One run of the last image written: "length" bytes at "address", whose
+// CRC-32C is "crc".
+//
+struct ManifestImage {
+	uint64 address;
+	uint64 length;
+	uint32 crc;
+};
+
+// A FlashManifest is a FlashBaseline kept on the flash itself, so it stays
+// right even if the board is written by other hosts, as long as they all
+// maintain it. It records a CRC-32C of each erase region of the chip, and the
+// address, length and CRC-32C of each run of the last image written.
+//
+// The manifest lives in a reserved area of the flash, split into two slots of
+// whole erase regions, used alternately. Each copy carries a sequence number
+// and a CRC-32C of its own, so the newest intact copy wins; if writing one is
+// interrupted, the other remains. To keep it honest if a write is interrupted,
+// a copy marking the regions about to change as unknown is committed before the
+// write, and a copy with their new hashes after it.
+//
+class FlashManifest : public FlashBaseline {
+	const EraseBlockMap m_blockMap;
+	std::vector<uint32> m_hashes;
+	std::vector<uint8> m_known;
+	uint64 m_slots[3];              // start of each slot, then the end of the second
+	uint32 m_size;
+	uint32 m_sequence;
+	uint32 m_slot;
+	std::vector<ManifestImage> m_images;
+	bool isRegion(size_t index, uint64 address, uint32 regionSize) const;
+	bool reserved(size_t index) const;
+	uint32 regionHash(uint32 regionSize, const uint8 *data, uint32 length) const;
+public:
+	// Construct from a FlashChip, with the manifest slots starting at "address",
+	// which must be the start of an erase region.
+	FlashManifest(const FlashChip *flashChip, uint64 address);
+
+	// The area occupied by the two slots, and the number of bytes to read from
+	// the start of each slot when loading.
+	uint64 address() const { return m_slots[0]; }
+	uint64 length() const { return m_slots[2] - m_slots[0]; }
+	uint64 slotAddress(uint32 slot) const { return m_slots[slot]; }
+	uint32 size() const { return m_size; }
+
+	// Adopt the newest intact copy from the contents of the two slots, returning
+	// false if neither holds one (in which case nothing is known).
+	bool load(const uint8 *slot0, const uint8 *slot1);
+
+	// The runs of the last image written, according to the manifest. Throws if
+	// there are more than MANIFEST_MAX_IMAGES.
+	const std::vector<ManifestImage> &images() const { return m_images; }
+	uint32 sequence() const { return m_sequence; }
+	void setImages(const std::vector<ManifestImage> &images);
+
+	// Forget the regions which writing the data would change, returning how many
+	// there are (so zero means the flash already holds the data).
+	uint32 forgetChanges(uint64 address, uint64 length, const uint8 *data);
+
+	// Committing a new copy: prepare() encodes it and gives the address of the
+	// slot it must be written to; once it has been, committed() makes it current.
+	void prepare(std::vector<uint8> &buffer, uint64 *slotAddress) const;
+	void committed();
+
+	// FlashBaseline implementation
+	bool matches(uint64 address, uint32 regionSize, const uint8 *data, uint32 length);
+	bool isErased(uint64 address, uint32 regionSize);
+	void forget(uint64 address, uint64 length);
+	void update(uint64 address, uint32 regionSize, const uint8 *data, uint32 length);
+	uint32 samplePages(uint64 *addresses, uint32 maxCount);
+	bool checkPage(uint64 address, const uint8 *data);
+};
+
+#endif
@@ -0,0 +1,215 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstring>
+#include <makestuff.h>
+#include "hash.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#include <nmmintrin.h>
+	#define HW_CRC32C
+	#define HW_CRC32C_TARGET __attribute__((target("sse4.2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#include <intrin.h>
+	#include <nmmintrin.h>
+	#define HW_CRC32C
+	#define HW_CRC32C_TARGET
+#endif
+
+// The byte-at-a-time table for the reflected CRC-32C polynomial 0x82F63B78,
+// built at compile time so there is nothing to initialise when several threads
+// hash at once.
+static const uint32 crcTable[256] = {
+	0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4, 0xC79A971F, 0x35F1141C, 0x26A1E7E8, 0xD4CA64EB,
+	0x8AD958CF, 0x78B2DBCC, 0x6BE22838, 0x9989AB3B, 0x4D43CFD0, 0xBF284CD3, 0xAC78BF27, 0x5E133C24,
+	0x105EC76F, 0xE235446C, 0xF165B798, 0x030E349B, 0xD7C45070, 0x25AFD373, 0x36FF2087, 0xC494A384,
+	0x9A879FA0, 0x68EC1CA3, 0x7BBCEF57, 0x89D76C54, 0x5D1D08BF, 0xAF768BBC, 0xBC267848, 0x4E4DFB4B,
+	0x20BD8EDE, 0xD2D60DDD, 0xC186FE29, 0x33ED7D2A, 0xE72719C1, 0x154C9AC2, 0x061C6936, 0xF477EA35,
+	0xAA64D611, 0x580F5512, 0x4B5FA6E6, 0xB93425E5, 0x6DFE410E, 0x9F95C20D, 0x8CC531F9, 0x7EAEB2FA,
+	0x30E349B1, 0xC288CAB2, 0xD1D83946, 0x23B3BA45, 0xF779DEAE, 0x05125DAD, 0x1642AE59, 0xE4292D5A,
+	0xBA3A117E, 0x4851927D, 0x5B016189, 0xA96AE28A, 0x7DA08661, 0x8FCB0562, 0x9C9BF696, 0x6EF07595,
+	0x417B1DBC, 0xB3109EBF, 0xA0406D4B, 0x522BEE48, 0x86E18AA3, 0x748A09A0, 0x67DAFA54, 0x95B17957,
+	0xCBA24573, 0x39C9C670, 0x2A993584, 0xD8F2B687, 0x0C38D26C, 0xFE53516F, 0xED03A29B, 0x1F682198,
+	0x5125DAD3, 0xA34E59D0, 0xB01EAA24, 0x42752927, 0x96BF4DCC, 0x64D4CECF, 0x77843D3B, 0x85EFBE38,
+	0xDBFC821C, 0x2997011F, 0x3AC7F2EB, 0xC8AC71E8, 0x1C661503, 0xEE0D9600, 0xFD5D65F4, 0x0F36E6F7,
+	0x61C69362, 0x93AD1061, 0x80FDE395, 0x72966096, 0xA65C047D, 0x5437877E, 0x4767748A, 0xB50CF789,
+	0xEB1FCBAD, 0x197448AE, 0x0A24BB5A, 0xF84F3859, 0x2C855CB2, 0xDEEEDFB1, 0xCDBE2C45, 0x3FD5AF46,
+	0x7198540D, 0x83F3D70E, 0x90A324FA, 0x62C8A7F9, 0xB602C312, 0x44694011, 0x5739B3E5, 0xA55230E6,
+	0xFB410CC2, 0x092A8FC1, 0x1A7A7C35, 0xE811FF36, 0x3CDB9BDD, 0xCEB018DE, 0xDDE0EB2A, 0x2F8B6829,
+	0x82F63B78, 0x709DB87B, 0x63CD4B8F, 0x91A6C88C, 0x456CAC67, 0xB7072F64, 0xA457DC90, 0x563C5F93,
+	0x082F63B7, 0xFA44E0B4, 0xE9141340, 0x1B7F9043, 0xCFB5F4A8, 0x3DDE77AB, 0x2E8E845F, 0xDCE5075C,
+	0x92A8FC17, 0x60C37F14, 0x73938CE0, 0x81F80FE3, 0x55326B08, 0xA759E80B, 0xB4091BFF, 0x466298FC,
+	0x1871A4D8, 0xEA1A27DB, 0xF94AD42F, 0x0B21572C, 0xDFEB33C7, 0x2D80B0C4, 0x3ED04330, 0xCCBBC033,
+	0xA24BB5A6, 0x502036A5, 0x4370C551, 0xB11B4652, 0x65D122B9, 0x97BAA1BA, 0x84EA524E, 0x7681D14D,
+	0x2892ED69, 0xDAF96E6A, 0xC9A99D9E, 0x3BC21E9D, 0xEF087A76, 0x1D63F975, 0x0E330A81, 0xFC588982,
+	0xB21572C9, 0x407EF1CA, 0x532E023E, 0xA145813D, 0x758FE5D6, 0x87E466D5, 0x94B49521, 0x66DF1622,
+	0x38CC2A06, 0xCAA7A905, 0xD9F75AF1, 0x2B9CD9F2, 0xFF56BD19, 0x0D3D3E1A, 0x1E6DCDEE, 0xEC064EED,
+	0xC38D26C4, 0x31E6A5C7, 0x22B65633, 0xD0DDD530, 0x0417B1DB, 0xF67C32D8, 0xE52CC12C, 0x1747422F,
+	0x49547E0B, 0xBB3FFD08, 0xA86F0EFC, 0x5A048DFF, 0x8ECEE914, 0x7CA56A17, 0x6FF599E3, 0x9D9E1AE0,
+	0xD3D3E1AB, 0x21B862A8, 0x32E8915C, 0xC083125F, 0x144976B4, 0xE622F5B7, 0xF5720643, 0x07198540,
+	0x590AB964, 0xAB613A67, 0xB831C993, 0x4A5A4A90, 0x9E902E7B, 0x6CFBAD78, 0x7FAB5E8C, 0x8DC0DD8F,
+	0xE330A81A, 0x115B2B19, 0x020BD8ED, 0xF0605BEE, 0x24AA3F05, 0xD6C1BC06, 0xC5914FF2, 0x37FACCF1,
+	0x69E9F0D5, 0x9B8273D6, 0x88D28022, 0x7AB90321, 0xAE7367CA, 0x5C18E4C9, 0x4F48173D, 0xBD23943E,
+	0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69, 0xD5CF889D, 0x27A40B9E,
+	0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E, 0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351
+};
+
+#ifdef HW_CRC32C
+	// Returns 1 if the CPU has SSE4.2, 0 if not.
+	static int haveSse42(void) {
+		#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 1);
+			return (info[2] >> 20) & 1;
+		#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse4.2") ? 1 : 0;
+		#endif
+	}
+
+	// Found during static initialisation, before any thread can call crc32c().
+	// Anything hashed before this is set just takes the table-driven path.
+	static const int haveHwCrc32c = haveSse42();
+
+	HW_CRC32C_TARGET static uint32 hwCrc32c(uint32 crc, const uint8 *data, size_t length) {
+		while ( length && ((size_t)data & 7) ) {
+			crc = _mm_crc32_u8(crc, *data++);
+			length--;
+		}
+		#if defined(__x86_64__) || defined(_M_X64)
+			while ( length >= 8 ) {
+				uint64 word;
+				memcpy(&word, data, 8);
+				crc = (uint32)_mm_crc32_u64(crc, word);
+				data += 8;
+				length -= 8;
+			}
+		#endif
+		while ( length >= 4 ) {
+			uint32 word;
+			memcpy(&word, data, 4);
+			crc = _mm_crc32_u32(crc, word);
+			data += 4;
+			length -= 4;
+		}
+		while ( length-- ) {
+			crc = _mm_crc32_u8(crc, *data++);
+		}
+		return crc;
+	}
+#endif
+
+uint32 crc32c(uint32 crc, const uint8 *data, size_t length) {
+	#ifdef HW_CRC32C
+		if ( haveHwCrc32c ) {
+			return ~hwCrc32c(~crc, data, length);
+		}
+	#endif
+	crc = ~crc;
+	while ( length-- ) {
+		crc = crcTable[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+// SHA-256, as specified in FIPS 180-4.
+static const uint32 shaRounds[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+Sha256::Sha256() : m_length(0) {
+	m_state[0] = 0x6A09E667;
+	m_state[1] = 0xBB67AE85;
+	m_state[2] = 0x3C6EF372;
+	m_state[3] = 0xA54FF53A;
+	m_state[4] = 0x510E527F;
+	m_state[5] = 0x9B05688C;
+	m_state[6] = 0x1F83D9AB;
+	m_state[7] = 0x5BE0CD19;
+}
+
+void Sha256::transform(const uint8 *block) {
+	uint32 w[64], a, b, c, d, e, f, g, h, t1, t2;
+	uint32 i;
+	for ( i = 0; i < 16; i++ ) {
+		w[i] = ((uint32)block[4*i] << 24) | (block[4*i+1] << 16) | (block[4*i+2] << 8) | block[4*i+3];
+	}
+	for ( i = 16; i < 64; i++ ) {
+		const uint32 s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+		const uint32 s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+	a = m_state[0]; b = m_state[1]; c = m_state[2]; d = m_state[3];
+	e = m_state[4]; f = m_state[5]; g = m_state[6]; h = m_state[7];
+	for ( i = 0; i < 64; i++ ) {
+		t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + shaRounds[i] + w[i];
+		t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d;
+	m_state[4] += e; m_state[5] += f; m_state[6] += g; m_state[7] += h;
+}
+
+void Sha256::update(const uint8 *data, size_t length) {
+	size_t used = (size_t)(m_length % 64);
+	m_length += length;
+	if ( used ) {
+		const size_t chunk = (length < 64 - used) ? length : 64 - used;
+		memcpy(m_block + used, data, chunk);
+		data += chunk;
+		length -= chunk;
+		if ( used + chunk < 64 ) {
+			return;
+		}
+		transform(m_block);
+	}
+	while ( length >= 64 ) {
+		transform(data);
+		data += 64;
+		length -= 64;
+	}
+	memcpy(m_block, data, length);
+}
+
+void Sha256::final(uint8 *digest) {
+	const uint64 bits = m_length * 8;
+	size_t used = (size_t)(m_length % 64);
+	uint32 i;
+	m_block[used++] = 0x80;
+	if ( used > 56 ) {
+		memset(m_block + used, 0, 64 - used);
+		transform(m_block);
+		used = 0;
+	}
+	memset(m_block + used, 0, 56 - used);
+	for ( i = 0; i < 8; i++ ) {
+		m_block[56 + i] = (uint8)(bits >> (56 - 8 * i));
+	}
+	transform(m_block);
+	for ( i = 0; i < 32; i++ ) {
+		digest[i] = (uint8)(m_state[i / 4] >> (24 - 8 * (i % 4)));
+	}
+}
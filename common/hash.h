@@ -0,0 +1,45 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef HASH_H
+#define HASH_H
+
+#include <makestuff.h>
+
+// CRC-32C (Castagnoli), used wherever flash contents are summarised by a fast
+// hash. To hash data in pieces, pass the previous return value as "crc" for
+// each subsequent piece; start with zero. Where the CPU has a CRC-32C
+// instruction (i.e x86 with SSE4.2), it is used.
+//
+uint32 crc32c(uint32 crc, const uint8 *data, size_t length);
+
+// SHA-256, for when a cryptographic digest of flash contents is needed. Feed it
+// data in pieces with update(), then get the digest with final(), after which
+// the object must not be updated again.
+//
+#define SHA256_LENGTH 32
+class Sha256 {
+	uint32 m_state[8];
+	uint64 m_length;
+	uint8 m_block[64];
+	void transform(const uint8 *block);
+public:
+	Sha256();
+	void update(const uint8 *data, size_t length);
+	void final(uint8 *digest);
+};
+
+#endif
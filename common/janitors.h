@@ -17,6 +17,8 @@
 #ifndef JANITORS_H
 #define JANITORS_H
 
+#include <vector>
+
 // Utility classes/templates for ensuring that resources are not leaked if an
 // exception occurs. The janitor is stack-constructed with a pointer to the
 // resource, and when the janitor goes out of scope its destructor frees the
@@ -40,6 +42,19 @@ public:
 	~ArrayJanitor() { delete []m_ptr; }
 };
 
+template<typename T> class VectorJanitor {
+	const std::vector<T *> &m_vec;
+	VectorJanitor(const VectorJanitor<T> &other);
+	VectorJanitor<T> &operator=(const VectorJanitor<T> &other);
+public:
+	explicit VectorJanitor(const std::vector<T *> &vec) : m_vec(vec) { }
+	~VectorJanitor() {
+		for ( typename std::vector<T *>::const_iterator it = m_vec.begin(); it != m_vec.end(); ++it ) {
+			delete *it;
+		}
+	}
+};
+
 class AllocJanitor {
 	uint8 *const m_ptr;
 	AllocJanitor &operator=(const AllocJanitor &other);
@@ -0,0 +1,84 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstdio>
+#include <string>
+#include "exception.h"
+#include "flash_device.h"
+#include "parallel_write.h"
+#include "sync.h"
+
+using namespace std;
+
+struct DeviceWrite {
+	FlashDevice *device;
+	const CompositeImage *image;
+	string error;
+};
+
+static void writeDevice(void *param) {
+	DeviceWrite *const write = (DeviceWrite *)param;
+	try {
+		write->device->write(*write->image);
+	}
+	catch ( const exception &ex ) {
+		write->error = ex.what();
+	}
+	catch ( ... ) {
+		write->error = "Unknown error";
+	}
+}
+
+void parallelWrite(const vector<FlashDevice *> &devices, const CompositeImage &image) {
+	vector<DeviceWrite> writes(devices.size());
+	vector<Thread *> threads;
+	size_t i;
+	for ( i = 0; i < devices.size(); i++ ) {
+		writes[i].device = devices[i];
+		writes[i].image = &image;
+	}
+	try {
+		for ( i = 1; i < writes.size(); i++ ) {
+			threads.push_back(new Thread(writeDevice, &writes[i]));
+			if ( !threads.back()->started() ) {
+				writeDevice(&writes[i]);  // no thread to spare, so just take turns
+			}
+		}
+		if ( !writes.empty() ) {
+			writeDevice(&writes[0]);
+		}
+	}
+	catch ( ... ) {
+		for ( vector<Thread *>::iterator it = threads.begin(); it != threads.end(); ++it ) {
+			delete *it;
+		}
+		throw;
+	}
+	for ( vector<Thread *>::iterator it = threads.begin(); it != threads.end(); ++it ) {
+		delete *it;  // joins it
+	}
+	for ( i = 0; i < writes.size(); i++ ) {
+		if ( !writes[i].error.empty() ) {
+			char msg[512];
+			sprintf(
+				msg, "parallelWrite(): Chip %u (%s %s): %.256s",
+				(uint32)i, writes[i].device->chip()->vendorName, writes[i].device->chip()->deviceName,
+				writes[i].error.c_str()
+			);
+			throw GordonException(msg);
+		}
+	}
+}
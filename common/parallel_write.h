@@ -0,0 +1,35 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef PARALLEL_WRITE_H
+#define PARALLEL_WRITE_H
+
+#include <vector>
+
+// Forward-declarations
+//
+class FlashDevice;
+class CompositeImage;
+
+// Write the same image to several chips at once, on a thread per chip (the
+// calling thread takes the first), so each chip's erases and page programs
+// overlap the others'. The devices' Transports must be safe to use from several
+// threads at once (see SharedTransport). Once every write has finished, this
+// throws if any of them failed.
+//
+void parallelWrite(const std::vector<FlashDevice *> &devices, const CompositeImage &image);
+
+#endif
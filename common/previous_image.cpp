@@ -0,0 +1,143 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstring>
+#include "flash_chips.h"
+#include "previous_image.h"
+#include "util.h"
+
+using namespace std;
+
+PreviousImage::PreviousImage(const FlashChip *flashChip, uint64 address, uint64 length, const uint8 *data) :
+	RegionWalker(flashChip),
+	m_pageSize(flashChip->pageSize),
+	m_base(address),
+	m_dataPtr(data),
+	m_random((uint32)microseconds() | 1)
+{
+	if ( flashChip->pagePatchFunc ) {
+		// Partial pages were patched, keeping whatever was around the image
+		const uint64 first = (address + m_pageSize - 1) / m_pageSize * m_pageSize;
+		const uint64 last = (address + length) / m_pageSize * m_pageSize;
+		if ( first < last ) {
+			m_base = first;
+			m_contents.assign(data + (first - address), data + (last - address));
+			m_known.assign((size_t)((last - first) / m_pageSize), 1);
+		}
+	} else {
+		walkRegions(address, length);
+	}
+}
+
+// Each region the old image covered holds its share of the image, then 0xFF.
+void PreviousImage::callback(uint64, uint32 blockSize, uint32 bytesUsed) {
+	m_contents.insert(m_contents.end(), m_dataPtr, m_dataPtr + bytesUsed);
+	m_contents.insert(m_contents.end(), blockSize - bytesUsed, 0xFF);
+	m_known.insert(m_known.end(), blockSize / m_pageSize, 1);
+	m_dataPtr += bytesUsed;
+}
+
+bool PreviousImage::pagesKnown(uint64 address, uint64 length) const {
+	uint64 page;
+	if ( !length || address < m_base || length > m_contents.size() || address - m_base > m_contents.size() - length ) {
+		return false;
+	}
+	for ( page = (address - m_base) / m_pageSize; page <= (address - m_base + length - 1) / m_pageSize; page++ ) {
+		if ( !m_known[(size_t)page] ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool PreviousImage::matches(uint64 address, uint32 regionSize, const uint8 *data, uint32 length) {
+	const uint8 *ptr;
+	uint32 i;
+	if ( !pagesKnown(address, regionSize) ) {
+		return false;
+	}
+	ptr = &m_contents[(size_t)(address - m_base)];
+	if ( memcmp(ptr, data, length) ) {
+		return false;
+	}
+	for ( i = length; i < regionSize && ptr[i] == 0xFF; i++ );
+	return i == regionSize;
+}
+
+bool PreviousImage::isErased(uint64 address, uint32 regionSize) {
+	const uint8 *ptr;
+	uint32 i;
+	if ( !pagesKnown(address, regionSize) ) {
+		return false;
+	}
+	ptr = &m_contents[(size_t)(address - m_base)];
+	for ( i = 0; i < regionSize && ptr[i] == 0xFF; i++ );
+	return i == regionSize;
+}
+
+void PreviousImage::forget(uint64 address, uint64 length) {
+	const uint64 end = m_base + m_contents.size();
+	uint64 page;
+	if ( address >= end || !length || (address < m_base && length <= m_base - address) ) {
+		return;
+	}
+	if ( address < m_base ) {
+		length -= m_base - address;
+		address = m_base;
+	}
+	if ( length > end - address ) {
+		length = end - address;
+	}
+	for ( page = (address - m_base) / m_pageSize; page <= (address - m_base + length - 1) / m_pageSize; page++ ) {
+		m_known[(size_t)page] = 0;
+	}
+}
+
+// Only what the old image covered is tracked, so regions outside it stay unknown.
+void PreviousImage::update(uint64 address, uint32 regionSize, const uint8 *data, uint32 length) {
+	uint64 page;
+	if (
+		address < m_base || address + regionSize > m_base + m_contents.size() ||
+		(address - m_base) % m_pageSize || regionSize % m_pageSize )
+	{
+		forget(address, regionSize);
+		return;
+	}
+	memcpy(&m_contents[(size_t)(address - m_base)], data, length);
+	memset(&m_contents[(size_t)(address - m_base) + length], 0xFF, regionSize - length);
+	for ( page = (address - m_base) / m_pageSize; page < (address - m_base + regionSize) / m_pageSize; page++ ) {
+		m_known[(size_t)page] = 1;
+	}
+}
+
+uint32 PreviousImage::samplePages(uint64 *addresses, uint32 maxCount) {
+	const uint32 numPages = (uint32)m_known.size();
+	uint32 count;
+	if ( !numPages ) {
+		return 0;
+	}
+	for ( count = 0; count < maxCount; count++ ) {
+		m_random ^= m_random << 13;
+		m_random ^= m_random >> 17;
+		m_random ^= m_random << 5;
+		addresses[count] = m_base + (uint64)(m_random % numPages) * m_pageSize;
+	}
+	return count;
+}
+
+bool PreviousImage::checkPage(uint64 address, const uint8 *data) {
+	return !memcmp(&m_contents[(size_t)(address - m_base)], data, m_pageSize);
+}
@@ -0,0 +1,54 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef PREVIOUS_IMAGE_H
+#define PREVIOUS_IMAGE_H
+
+#include <vector>
+#include "region_walker.h"
+#include "flash_baseline.h"
+
+// A PreviousImage is a FlashBaseline for delta updates: given the image which
+// was last written at some address, it describes what that write left on the
+// flash, so writing a new image there only touches the regions which differ.
+// The regions covered by the old image are walked as they were when it was
+// written, so the rest of its last region is known to be 0xFF; on chips which
+// patch partial pages in place, only the pages the image filled are known.
+//
+class PreviousImage : public FlashBaseline, private RegionWalker {
+	const uint32 m_pageSize;
+	uint64 m_base;
+	std::vector<uint8> m_contents;
+	std::vector<uint8> m_known;
+	const uint8 *m_dataPtr;
+	uint32 m_random;
+	void callback(uint64 blockAddress, uint32 blockSize, uint32 bytesUsed);
+	bool pagesKnown(uint64 address, uint64 length) const;
+public:
+	// Construct from a FlashChip and the image last written to "address". The
+	// image is copied, so the caller need not keep it.
+	PreviousImage(const FlashChip *flashChip, uint64 address, uint64 length, const uint8 *data);
+
+	// FlashBaseline implementation
+	bool matches(uint64 address, uint32 regionSize, const uint8 *data, uint32 length);
+	bool isErased(uint64 address, uint32 regionSize);
+	void forget(uint64 address, uint64 length);
+	void update(uint64 address, uint32 regionSize, const uint8 *data, uint32 length);
+	uint32 samplePages(uint64 *addresses, uint32 maxCount);
+	bool checkPage(uint64 address, const uint8 *data);
+};
+
+#endif
@@ -0,0 +1,108 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstring>
+#include "region_programmer.h"
+#include "read_cache.h"
+
+ReadCache::ReadCache(
+	RegionProgrammer *programmer, uint64 capacity,
+	uint32 chunkSize, uint32 maxChunks, uint32 maxReadAhead) :
+	m_programmer(programmer), m_capacity(capacity),
+	m_chunkSize(chunkSize), m_maxChunks(maxChunks), m_maxReadAhead(maxReadAhead),
+	m_nextAddress(capacity), m_readAhead(0)
+{ }
+
+void ReadCache::clear() {
+	m_chunks.clear();
+	m_index.clear();
+	m_nextAddress = m_capacity;
+	m_readAhead = 0;
+}
+
+// Fetch the chunks from the one at "address" (which is chunk-aligned and not in
+// the cache) up to the one containing "end - 1", stopping early at any already in
+// the cache, with one read of the flash. During a sequential scan, carry on for
+// up to m_readAhead chunks beyond "end".
+void ReadCache::fetch(uint64 address, uint64 end, bool sequential) {
+	uint64 fetchEnd = address + m_chunkSize;
+	if ( sequential ) {
+		m_readAhead = m_readAhead ? 2 * m_readAhead : 1;
+		if ( m_readAhead > m_maxReadAhead ) {
+			m_readAhead = m_maxReadAhead;
+		}
+		end += (uint64)m_readAhead * m_chunkSize;
+	} else {
+		m_readAhead = 0;
+	}
+	if ( end > m_capacity ) {
+		end = m_capacity;
+	}
+	while (
+		fetchEnd < end && fetchEnd - address < (uint64)m_maxChunks * m_chunkSize &&
+		m_index.find(fetchEnd) == m_index.end() )
+	{
+		fetchEnd += m_chunkSize;
+	}
+	if ( fetchEnd > m_capacity ) {
+		fetchEnd = m_capacity;
+	}
+	std::vector<uint8> buffer((size_t)(fetchEnd - address));
+	m_programmer->fetch(address, buffer.size(), &buffer[0]);
+	for ( uint64 offset = 0; offset < buffer.size(); offset += m_chunkSize ) {
+		const uint64 length = (buffer.size() - offset < m_chunkSize) ? buffer.size() - offset : m_chunkSize;
+		m_chunks.push_front(Chunk());
+		m_chunks.front().address = address + offset;
+		m_chunks.front().data.assign(buffer.begin() + offset, buffer.begin() + offset + length);
+		m_index[address + offset] = m_chunks.begin();
+	}
+	while ( m_chunks.size() > m_maxChunks ) {
+		m_index.erase(m_chunks.back().address);
+		m_chunks.pop_back();
+	}
+}
+
+void ReadCache::read(uint64 address, uint64 length, uint8 *buffer) {
+	const uint64 end = address + length;
+	const bool sequential = (address == m_nextAddress);
+	bool fetched = false;
+	if ( length > (uint64)m_maxChunks * m_chunkSize / 2 || end < address || end > m_capacity ) {
+		m_programmer->read(address, length, buffer);  // too big to cache, or it throws
+		m_nextAddress = end;
+		return;
+	}
+	while ( address < end ) {
+		const uint64 chunkAddress = address - address % m_chunkSize;
+		std::map<uint64, ChunkList::iterator>::const_iterator found = m_index.find(chunkAddress);
+		if ( found == m_index.end() ) {
+			fetch(chunkAddress, end, sequential && !fetched);
+			fetched = true;
+			found = m_index.find(chunkAddress);
+		} else {
+			m_chunks.splice(m_chunks.begin(), m_chunks, found->second);
+		}
+		const Chunk &chunk = *found->second;
+		const uint64 offset = address - chunkAddress;
+		uint64 count = chunk.data.size() - offset;
+		if ( count > end - address ) {
+			count = end - address;
+		}
+		memcpy(buffer, &chunk.data[(size_t)offset], (size_t)count);
+		buffer += count;
+		address += count;
+	}
+	m_nextAddress = end;
+}
@@ -0,0 +1,76 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef READ_CACHE_H
+#define READ_CACHE_H
+
+#include <list>
+#include <map>
+#include <vector>
+#include <makestuff.h>
+
+class RegionProgrammer;
+
+/**
+ * A cache of recently-read flash contents, for callers which make many small
+ * reads (e.g parsing headers or multi-boot tables). The flash is divided into
+ * aligned chunks; a read is served from the chunks already held, and the chunks
+ * it lacks are fetched together in one read of the flash. The least-recently
+ * used chunks are dropped to make room for new ones.
+ *
+ * A read which starts where the previous one ended is taken to be part of a
+ * sequential scan: the chunks after it are then fetched too, and the number
+ * fetched ahead doubles with each such read which misses, up to a limit. Any
+ * other read which misses resets it. Reads too big to benefit are not cached at all.
+ *
+ * The cache knows nothing of writes; whoever writes the flash must clear() it.
+ */
+class ReadCache {
+	struct Chunk {
+		uint64 address;
+		std::vector<uint8> data;  // shorter than the chunk size at the end of the chip
+	};
+	typedef std::list<Chunk> ChunkList;
+	RegionProgrammer *const m_programmer;
+	const uint64 m_capacity;
+	const uint32 m_chunkSize;
+	const uint32 m_maxChunks;
+	const uint32 m_maxReadAhead;
+	ChunkList m_chunks;  // most-recently used first
+	std::map<uint64, ChunkList::iterator> m_index;
+	uint64 m_nextAddress;
+	uint32 m_readAhead;
+	ReadCache &operator=(const ReadCache &other);
+	ReadCache(const ReadCache &other);
+	void fetch(uint64 address, uint64 end, bool sequential);
+public:
+	// Cache the reads of a chip of "capacity" bytes through the programmer, in
+	// up to "maxChunks" chunks of "chunkSize" bytes, reading at most
+	// "maxReadAhead" chunks ahead of a sequential scan.
+	ReadCache(
+		RegionProgrammer *programmer, uint64 capacity,
+		uint32 chunkSize, uint32 maxChunks, uint32 maxReadAhead
+	);
+
+	// Read "length" bytes from the given address into the buffer. Reads bigger
+	// than half the cache go straight to the programmer.
+	void read(uint64 address, uint64 length, uint8 *buffer);
+
+	// Forget everything, e.g because the flash has been written.
+	void clear();
+};
+
+#endif
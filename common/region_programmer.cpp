@@ -15,51 +15,750 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <algorithm>
 #include "exception.h"
 #include "flash_chips.h"
+#include "flash_baseline.h"
+#include "write_journal.h"
+#include "file_loader.h"
 #include "region_programmer.h"
+#include "janitors.h"
+#include "hash.h"
+#include "util.h"
 
-void RegionProgrammer::callback(uint32 blockAddress, uint32 bytesUsed) {
-	const uint32 pageSize = m_flashChip->pageSize;
-	const BlockEraseFunc eraseFunc = m_flashChip->blockEraseFunc;
-	const PageProgramFunc progFunc = m_flashChip->pageProgramFunc;
-	eraseFunc(m_flashChip, m_transport, blockAddress);
-	while ( bytesUsed > pageSize ) {
-		progFunc(m_flashChip, m_transport, blockAddress, pageSize, m_dataPtr);
-		m_dotCount++;
-		m_dotCount &= 0x3F;
-		printf(m_dotCount ? "." : ".\n");
-		fflush(stdout);
-		m_dataPtr += pageSize;
-		blockAddress += pageSize;
-		bytesUsed -= pageSize;
-	}
-	progFunc(m_flashChip, m_transport, blockAddress, bytesUsed, m_dataPtr);
+#define VERIFY_CHUNK 65536
+#define READ_CHUNK 0x40000000
+#define MAX_MISMATCHES 8
+#define DIGEST_CHUNK 65536
+#define SAMPLE_CHUNK 65536
+
+RegionProgrammer::RegionProgrammer(const Transport *transport, const FlashChip *thisChip) :
+	RegionWalker(thisChip), m_transport(transport), m_nextBlock(0), m_writing(false),
+	m_eraseTime(0), m_eraseCount(0), m_programTime(0), m_programCount(0),
+	m_baseline(NULL), m_skipCount(0), m_verify(false), m_journal(NULL), m_loader(NULL)
+{
+	if ( m_flashChip->enterFunc ) {
+		m_flashChip->enterFunc(m_flashChip, m_transport);
+	}
+}
+
+RegionProgrammer::~RegionProgrammer() {
+	if ( m_flashChip->exitFunc ) {
+		try {
+			m_flashChip->exitFunc(m_flashChip, m_transport);
+		}
+		catch ( ... ) { }
+	}
+}
+
+void RegionProgrammer::checkCapacity(const char *caller, uint64 address, uint64 length) const {
+	const uint64 capacity = (uint64)1024 * m_flashChip->kbCapacity;
+	if ( length > capacity || address > capacity - length ) {
+		char msg[256];
+		sprintf(
+			msg,
+			"RegionProgrammer::%s(): Requested %llu bytes at address %llu from a device with a capacity of only %llu bytes!",
+			caller, (unsigned long long)length, (unsigned long long)address, (unsigned long long)capacity
+		);
+		throw GordonException(msg);
+	}
+}
+
+// Map a flash address onto the good blocks, checking more blocks if necessary.
+uint64 RegionProgrammer::physicalAddress(uint64 address) {
+	const BadBlockFunc badBlockFunc = m_flashChip->badBlockFunc;
+	if ( !badBlockFunc ) {
+		return address;
+	}
+	const uint32 blockSize = m_flashChip->eraseRegions[0].size;
+	const uint64 capacity = (uint64)1024 * m_flashChip->kbCapacity;
+	const uint64 blockNum = address / blockSize;
+	while ( m_goodBlocks.size() <= blockNum ) {
+		if ( m_nextBlock >= capacity ) {
+			char msg[256];
+			sprintf(
+				msg,
+				"RegionProgrammer::physicalAddress(): Address 0x%08llX is beyond the last good block!",
+				(unsigned long long)address
+			);
+			throw GordonException(msg);
+		}
+		if ( badBlockFunc(m_flashChip, m_transport, m_nextBlock) ) {
+			printf("Skipping bad block at 0x%08llX\n", (unsigned long long)m_nextBlock);
+		} else {
+			m_goodBlocks.push_back(m_nextBlock);
+		}
+		m_nextBlock += blockSize;
+	}
+	return m_goodBlocks[(size_t)blockNum] + address % blockSize;
+}
+
+// Read through the map of good blocks, with each run of physically-contiguous
+// blocks read in one go.
+void RegionProgrammer::readMapped(uint64 address, uint64 length, uint8 *buffer) {
+	const uint32 blockSize = m_flashChip->eraseRegions[0].size;
+	while ( length ) {
+		const uint64 physical = physicalAddress(address);
+		uint64 chunkLength = length;
+		if ( m_flashChip->badBlockFunc ) {
+			chunkLength = blockSize - address % blockSize;
+			while ( chunkLength < length && chunkLength < READ_CHUNK && physicalAddress(address + chunkLength) == physical + chunkLength ) {
+				chunkLength += blockSize;
+			}
+		}
+		if ( chunkLength > length ) {
+			chunkLength = length;
+		}
+		if ( chunkLength > READ_CHUNK ) {
+			chunkLength = READ_CHUNK;
+		}
+		m_flashChip->readFunc(m_flashChip, m_transport, physical, (uint32)chunkLength, buffer);
+		address += chunkLength;
+		length -= chunkLength;
+		buffer += chunkLength;
+	}
+}
+
+// Returns true if there is a queued priority read which does not overlap the
+// range [avoidStart, avoidEnd).
+bool RegionProgrammer::readsPending(uint64 avoidStart, uint64 avoidEnd) {
+	LockJanitor lock(m_readMutex);
+	for ( std::deque<PendingRead *>::const_iterator it = m_readQueue.begin(); it != m_readQueue.end(); ++it ) {
+		if ( (*it)->address >= avoidEnd || (*it)->address + (*it)->length <= avoidStart ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Service the queued priority reads which do not overlap the range
+// [avoidStart, avoidEnd), leaving the rest queued.
+void RegionProgrammer::serviceReads(uint64 avoidStart, uint64 avoidEnd) {
+	for ( ; ; ) {
+		PendingRead *request = NULL;
+		{
+			LockJanitor lock(m_readMutex);
+			for ( std::deque<PendingRead *>::iterator it = m_readQueue.begin(); it != m_readQueue.end(); ++it ) {
+				if ( (*it)->address >= avoidEnd || (*it)->address + (*it)->length <= avoidStart ) {
+					request = *it;
+					m_readQueue.erase(it);
+					break;
+				}
+			}
+		}
+		if ( !request ) {
+			return;
+		}
+		try {
+			readMapped(request->address, request->length, request->buffer);
+		}
+		catch ( const std::exception &ex ) {
+			LockJanitor lock(m_readMutex);
+			request->error = ex.what();
+			request->done = true;
+			m_readDone.broadcast();
+			throw;
+		}
+		LockJanitor lock(m_readMutex);
+		request->done = true;
+		m_readDone.broadcast();
+	}
+}
+
+// The write is over, so fail any priority reads still queued.
+void RegionProgrammer::abortReads() {
+	LockJanitor lock(m_readMutex);
+	m_writing = false;
+	while ( !m_readQueue.empty() ) {
+		m_readQueue.front()->error = "RegionProgrammer::priorityRead(): The write was aborted!";
+		m_readQueue.front()->done = true;
+		m_readQueue.pop_front();
+	}
+	m_readDone.broadcast();
+}
+
+// Erase the "blockSize"-byte region at the flash address "address". If the chip
+// can suspend the erase, poll it instead of waiting, suspending it to service
+// priority reads; the time spent suspended is not counted as erase time.
+void RegionProgrammer::eraseBlock(uint64 address, uint32 blockSize) {
+	const EraseSuspend *const eraseSuspend = m_flashChip->eraseSuspend;
+	const uint64 start = microseconds();
+	uint64 suspended = 0;
+	if ( eraseSuspend ) {
+		const uint64 blockEnd = address + blockSize;
+		eraseSuspend->startFunc(m_flashChip, m_transport, address);
+		while ( eraseSuspend->busyFunc(m_flashChip, m_transport, address) ) {
+			if ( readsPending(address, blockEnd) ) {
+				const uint64 suspendStart = microseconds();
+				eraseSuspend->suspendFunc(m_flashChip, m_transport);
+				serviceReads(address, blockEnd);
+				eraseSuspend->resumeFunc(m_flashChip, m_transport);
+				suspended += microseconds() - suspendStart;
+			}
+		}
+	} else {
+		m_flashChip->blockEraseFunc(m_flashChip, m_transport, address);
+	}
+	m_eraseTime += microseconds() - start - suspended;
+	m_eraseCount++;
+}
+
+// Program one page (or the first "length" bytes of it), timing it if it runs to
+// completion, then service any priority reads and advance the data pointer. A
+// patch also moves the rest of the page through the chip's buffer, so it is
+// not timed with the plain page programs.
+void RegionProgrammer::programPage(PageProgramFunc progFunc, uint64 address, uint32 length) {
+	const uint64 start = microseconds();
+	progFunc(m_flashChip, m_transport, address, length, m_dataPtr);
+	if ( m_bulkPending ) {
+		if ( readsPending(0, 0) ) {
+			m_flashChip->bulkWrite->waitFunc(m_flashChip, m_transport);  // reads must wait for the commit
+			serviceReads(0, 0);
+		}
+	} else {
+		if ( progFunc != m_flashChip->pagePatchFunc ) {
+			m_programTime += microseconds() - start;
+			m_programCount++;
+		}
+		serviceReads(0, 0);
+	}
 	m_dotCount++;
 	m_dotCount &= 0x3F;
 	printf(m_dotCount ? "." : ".\n");
 	fflush(stdout);
-	m_dataPtr += bytesUsed;
+	m_dataPtr += length;
+}
+
+// Program "length" bytes of data into the region at (physical) flash address
+// "address". Pages of 0xFF need not be programmed into a region known to be
+// erased.
+void RegionProgrammer::programRegion(PageProgramFunc progFunc, uint64 address, uint32 length, bool erased) {
+	const uint32 pageSize = m_flashChip->pageSize;
+	while ( length ) {
+		const uint32 chunkLength = (length > pageSize) ? pageSize : length;
+		uint32 i = 0;
+		if ( erased ) {
+			for ( i = 0; i < chunkLength && m_dataPtr[i] == 0xFF; i++ );
+		}
+		if ( i < chunkLength ) {
+			programPage(progFunc, address, chunkLength);
+		} else {
+			m_dataPtr += chunkLength;
+		}
+		address += chunkLength;
+		length -= chunkLength;
+	}
+}
+
+// Read back "length" bytes just written at flash address "address", and compare
+// them with the data, reporting the ranges which differ. Returns true if there
+// are none.
+bool RegionProgrammer::verifyRegion(uint64 address, const uint8 *data, uint32 length) {
+	std::vector<uint8> buffer(length);
+	uint32 i = 0, start, numRanges = 0;
+	readMapped(address, length, &buffer[0]);
+	if ( !memcmp(&buffer[0], data, length) ) {
+		return true;
+	}
+	printf("\n");
+	while ( i < length ) {
+		if ( buffer[i] == data[i] ) {
+			i++;
+			continue;
+		}
+		for ( start = i; i < length && buffer[i] != data[i]; i++ );
+		if ( numRanges < MAX_MISMATCHES ) {
+			printf(
+				"Mismatch at 0x%08llX-0x%08llX\n",
+				(unsigned long long)(address + start), (unsigned long long)(address + i - 1)
+			);
+		}
+		numRanges++;
+	}
+	if ( numRanges > MAX_MISMATCHES ) {
+		printf("...and %u more mismatches\n", numRanges - MAX_MISMATCHES);
+	}
+	return false;
+}
+
+// When streaming, wait for the next "length" bytes of data to be loaded.
+void RegionProgrammer::waitForData(uint32 length) {
+	if ( m_loader ) {
+		m_loader->waitFor((size_t)(m_dataPtr - m_loader->data()) + length);
+	}
+}
+
+void RegionProgrammer::callback(uint64 blockAddress, uint32 blockSize, uint32 bytesUsed) {
+	const uint32 pageSize = m_flashChip->pageSize;
+	const BulkWrite *const bulkWrite = m_flashChip->bulkWrite;
+	const uint64 logicalAddress = blockAddress;
+	const uint8 *const blockData = m_dataPtr;
+	const uint32 dataLength = bytesUsed;
+	PageProgramFunc progFunc = m_flashChip->pageProgramFunc;
+	uint64 bulkAddress = 0, bulkSize = 0;
+	bool erased = false;
+	if ( m_baseline ) {
+		// Skip the region entirely if it would not change; otherwise, it will be
+		// in an unknown state until it has been programmed.
+		waitForData(bytesUsed);
+		if ( m_baseline->matches(blockAddress, blockSize, m_dataPtr, bytesUsed) ) {
+			m_dataPtr += bytesUsed;
+			m_skipCount++;
+			if ( m_journal ) {
+				m_journal->completed(blockAddress, bytesUsed);
+			}
+			return;
+		}
+		erased = m_baseline->isErased(blockAddress, blockSize);
+		m_baseline->forget(blockAddress, blockSize);
+	}
+	if ( bulkWrite ) {
+		bulkSize = bulkWrite->blockPages * pageSize;
+		bulkAddress = blockAddress - blockAddress % bulkSize;
+	}
+	if ( bulkSize && bulkAddress >= m_bulkStart && bulkAddress + bulkSize <= m_bulkEnd ) {
+		// This region lies in a bulk block entirely covered by the write, so erase
+		// the whole block on its first region, and program without erasing.
+		if ( blockAddress == bulkAddress ) {
+			bulkWrite->blockEraseFunc(m_flashChip, m_transport, bulkAddress);
+		}
+		progFunc = bulkWrite->pageProgramFunc;
+		m_bulkPending = true;
+	} else {
+		if ( m_bulkPending ) {
+			bulkWrite->waitFunc(m_flashChip, m_transport);
+			m_bulkPending = false;
+		}
+		blockAddress = physicalAddress(blockAddress);
+		if ( !erased ) {
+			eraseBlock(blockAddress, blockSize);
+		}
+	}
+	waitForData(bytesUsed);
+	programRegion(progFunc, blockAddress, bytesUsed, erased);
+	if ( m_verify ) {
+		if ( m_bulkPending ) {
+			bulkWrite->waitFunc(m_flashChip, m_transport);  // the pages must be committed to be read
+			m_bulkPending = false;
+		}
+		if ( !verifyRegion(logicalAddress, blockData, dataLength) ) {
+			printf("Rewriting the region at 0x%08llX...\n", (unsigned long long)logicalAddress);
+			m_dataPtr = blockData;
+			eraseBlock(blockAddress, blockSize);
+			programRegion(m_flashChip->pageProgramFunc, blockAddress, dataLength, true);
+			if ( !verifyRegion(logicalAddress, blockData, dataLength) ) {
+				char msg[256];
+				sprintf(
+					msg,
+					"RegionProgrammer::write(): Verification failed for the region at 0x%08llX, even after rewriting it!",
+					(unsigned long long)logicalAddress
+				);
+				throw GordonException(msg);
+			}
+		}
+	}
+	if ( m_baseline ) {
+		m_baseline->update(logicalAddress, blockSize, blockData, dataLength);
+	}
+	if ( m_journal ) {
+		m_journal->completed(logicalAddress, dataLength);
+	}
 }
 
-void RegionProgrammer::write(uint32 address, uint32 length, const uint8 *data) {
-	printf("Writing 0x%08X bytes to address 0x%08X...\n", length, address);
+// Patch part of a page in place. The rest of the page is kept, so afterwards it
+// is read back to tell the baseline what the page now holds. If the baseline
+// shows the page already holds the data followed by 0xFF, the patch is skipped.
+void RegionProgrammer::patchPage(uint64 address, uint32 length) {
+	const uint32 pageSize = m_flashChip->pageSize;
+	const uint64 pageAddress = address - address % pageSize;
+	waitForData(length);
+	if ( m_baseline ) {
+		if ( pageAddress == address && m_baseline->matches(address, pageSize, m_dataPtr, length) ) {
+			m_dataPtr += length;
+			m_skipCount++;
+			if ( m_journal ) {
+				m_journal->completed(address, length);
+			}
+			return;
+		}
+		m_baseline->forget(pageAddress, pageSize);
+	}
+	programPage(m_flashChip->pagePatchFunc, address, length);
+	if ( m_verify && !verifyRegion(address, m_dataPtr - length, length) ) {
+		printf("Rewriting the page at 0x%08llX...\n", (unsigned long long)pageAddress);
+		m_dataPtr -= length;
+		programPage(m_flashChip->pagePatchFunc, address, length);
+		if ( !verifyRegion(address, m_dataPtr - length, length) ) {
+			char msg[256];
+			sprintf(
+				msg,
+				"RegionProgrammer::write(): Verification failed for the page at 0x%08llX, even after rewriting it!",
+				(unsigned long long)pageAddress
+			);
+			throw GordonException(msg);
+		}
+	}
+	if ( m_baseline ) {
+		std::vector<uint8> page(pageSize);
+		readMapped(pageAddress, pageSize, &page[0]);
+		m_baseline->update(pageAddress, pageSize, &page[0], pageSize);
+	}
+	if ( m_journal ) {
+		m_journal->completed(address, length);
+	}
+}
+
+void RegionProgrammer::write(uint64 address, uint64 length, const uint8 *data, WriteJournal *journal) {
+	uint64 lastAddress;
+	uint32 lastLength;
+	m_journal = journal;
+	if ( journal && journal->begin(address, length, data, &lastAddress, &lastLength) ) {
+		uint64 done = lastAddress - address;
+		if ( verifyRegion(lastAddress, data + done, lastLength) ) {
+			done += lastLength;
+		}
+		if ( done == length ) {
+			printf(
+				"The 0x%08llX bytes at 0x%08llX were already written\n",
+				(unsigned long long)length, (unsigned long long)address
+			);
+			return;
+		}
+		printf("Resuming the write at 0x%08llX\n", (unsigned long long)(address + done));
+		address += done;
+		length -= done;
+		data += done;
+	}
+	printf(
+		"Writing 0x%08llX bytes to address 0x%08llX...\n",
+		(unsigned long long)length, (unsigned long long)address
+	);
+	const uint32 pageSize = m_flashChip->pageSize;
+	const PagePatchFunc patchFunc = m_flashChip->pagePatchFunc;
+	uint32 headLength = 0, tailLength = 0;
 	m_dataPtr = data;
 	m_dotCount = 0;
-	walkRegions(address, length);
+
+	// Chips which can patch a page in place do so for an unaligned start and a
+	// partial last page, preserving the rest of those pages; the other pages are
+	// erased and programmed as usual.
+	if ( patchFunc ) {
+		checkCapacity("write", address, length);
+		if ( address % pageSize ) {
+			headLength = pageSize - (uint32)(address % pageSize);
+			if ( headLength > length ) {
+				headLength = (uint32)length;
+			}
+		}
+		tailLength = (uint32)((length - headLength) % pageSize);
+	}
+	const uint64 middleLength = length - headLength - tailLength;
+
+	// The last page is padded, so it counts as covered when planning bulk writes.
+	// A bulk erase would wipe pages which the baseline allows to be skipped, so
+	// there are no bulk writes when there is a baseline.
+	m_bulkStart = address + headLength;
+	m_bulkEnd = m_baseline ? m_bulkStart : m_bulkStart + (middleLength + pageSize - 1) / pageSize * pageSize;
+	m_bulkPending = false;
+	m_skipCount = 0;
+	{
+		LockJanitor lock(m_readMutex);
+		m_writing = true;
+	}
+	try {
+		if ( headLength ) {
+			patchPage(address, headLength);
+		}
+		if ( middleLength ) {
+			walkRegions(address + headLength, middleLength);
+		}
+		if ( m_bulkPending ) {
+			m_flashChip->bulkWrite->waitFunc(m_flashChip, m_transport);
+			m_bulkPending = false;
+		}
+		if ( tailLength ) {
+			patchPage(address + length - tailLength, tailLength);
+		}
+		{
+			LockJanitor lock(m_readMutex);
+			m_writing = false;
+		}
+		serviceReads(0, 0);
+	}
+	catch ( ... ) {
+		abortReads();
+		throw;
+	}
 	printf("\n");
+	if ( m_skipCount ) {
+		printf("Skipped %u unchanged region%s\n", m_skipCount, (m_skipCount == 1) ? "" : "s");
+	}
+}
+
+void RegionProgrammer::setVerify(bool verify) {
+	m_verify = verify;
+}
+
+void RegionProgrammer::setBaseline(FlashBaseline *baseline) {
+	m_baseline = baseline;
+}
+
+void RegionProgrammer::setLoader(FileLoader *loader) {
+	m_loader = loader;
+}
+
+bool RegionProgrammer::checkBaseline(uint32 numSamples) {
+	const uint32 pageSize = m_flashChip->pageSize;
+	std::vector<uint64> addresses(numSamples);
+	std::vector<uint8> page(pageSize);
+	uint32 count, i;
+	if ( !m_baseline || !numSamples ) {
+		return true;
+	}
+	count = m_baseline->samplePages(&addresses[0], numSamples);
+	for ( i = 0; i < count; i++ ) {
+		readMapped(addresses[i], pageSize, &page[0]);
+		if ( !m_baseline->checkPage(addresses[i], &page[0]) ) {
+			m_baseline->forget(0, (uint64)1024 * m_flashChip->kbCapacity);
+			return false;
+		}
+	}
+	return true;
+}
+
+uint32 RegionProgrammer::eraseTimeMs() const {
+	return m_eraseCount ? (uint32)((m_eraseTime / m_eraseCount + 500) / 1000) : 0;
 }
 
-void RegionProgrammer::read(uint32 address, uint32 length, uint8 *buffer) {
-	printf("Reading 0x%08X bytes from address 0x%08X...\n", length, address);
-	if ( address + length > 1024 * m_flashChip->kbCapacity ) {
+uint32 RegionProgrammer::programTimeUs() const {
+	return m_programCount ? (uint32)(m_programTime / m_programCount) : 0;
+}
+
+uint32 RegionProgrammer::readBytesPerSecond(uint32 length) {
+	std::vector<uint8> buffer(length);
+	uint64 start, elapsed;
+	checkCapacity("readBytesPerSecond", 0, length);
+	start = microseconds();
+	readMapped(0, length, &buffer[0]);
+	elapsed = microseconds() - start;
+	return elapsed ? (uint32)((uint64)length * 1000000 / elapsed) : 0;
+}
+
+void RegionProgrammer::read(uint64 address, uint64 length, uint8 *buffer) {
+	printf(
+		"Reading 0x%08llX bytes from address 0x%08llX...\n",
+		(unsigned long long)length, (unsigned long long)address
+	);
+	checkCapacity("read", address, length);
+	readMapped(address, length, buffer);
+}
+
+void RegionProgrammer::fetch(uint64 address, uint64 length, uint8 *buffer) {
+	checkCapacity("fetch", address, length);
+	readMapped(address, length, buffer);
+}
+
+void RegionProgrammer::verify(uint64 address, uint64 length, const uint8 *data) {
+	printf(
+		"Verifying 0x%08llX bytes at address 0x%08llX...\n",
+		(unsigned long long)length, (unsigned long long)address
+	);
+	const PageVerifyFunc verifyFunc = m_flashChip->pageVerifyFunc;
+	const uint32 pageSize = m_flashChip->pageSize;
+	char msg[256];
+	checkCapacity("verify", address, length);
+	if ( verifyFunc && address % pageSize == 0 ) {
+		// Compare whole pages on-chip, one at a time; a partial last page may not
+		// be padded (see write()), so it is read back instead
+		while ( length >= pageSize ) {
+			if ( !verifyFunc(m_flashChip, m_transport, address, pageSize, data) ) {
+				sprintf(
+					msg,
+					"RegionProgrammer::verify(): Verification failed for the page at address 0x%08llX!",
+					(unsigned long long)address
+				);
+				throw GordonException(msg);
+			}
+			address += pageSize;
+			length -= pageSize;
+			data += pageSize;
+		}
+	}
+	if ( length ) {
+		// Read back and compare
+		uint8 *const buffer = new uint8[VERIFY_CHUNK];
+		ArrayJanitor<uint8> bufJan(buffer);
+		while ( length ) {
+			const uint32 chunkLength = (length > VERIFY_CHUNK) ? VERIFY_CHUNK : (uint32)length;
+			uint32 i;
+			readMapped(address, chunkLength, buffer);
+			for ( i = 0; i < chunkLength && buffer[i] == data[i]; i++ );
+			if ( i < chunkLength ) {
+				sprintf(
+					msg,
+					"RegionProgrammer::verify(): Verification failed at address 0x%08llX: expected 0x%02X, got 0x%02X!",
+					(unsigned long long)(address + i), data[i], buffer[i]
+				);
+				throw GordonException(msg);
+			}
+			address += chunkLength;
+			length -= chunkLength;
+			data += chunkLength;
+		}
+	}
+}
+
+void RegionProgrammer::sampledVerify(
+	uint64 address, uint64 length, const uint8 *data, uint32 numRandom, bool escalate)
+{
+	printf(
+		"Sample-verifying 0x%08llX bytes at address 0x%08llX...\n",
+		(unsigned long long)length, (unsigned long long)address
+	);
+	const uint32 pageSize = m_flashChip->pageSize;
+	const uint64 end = address + length;
+	std::vector<uint64> pages, failed;
+	EraseBlockMap::const_iterator it, last;
+	EraseBlock region;
+	uint64 checked = 0;
+	uint32 random = (uint32)microseconds() | 1, numReads = 0;
+	size_t i, j;
+	checkCapacity("sampledVerify", address, length);
+	if ( !length ) {
+		return;
+	}
+
+	// The first and last page of each erase region covered, plus some at random
+	for ( it = m_blockMap.lowerBound(address), last = m_blockMap.upperBound(address, length); it != last; ++it ) {
+		const uint64 first = (it->address < address) ? address : it->address;
+		const uint64 stop = (it->address + it->size < end) ? it->address + it->size : end;
+		pages.push_back(first / pageSize * pageSize);
+		pages.push_back((stop - 1) / pageSize * pageSize);
+	}
+	for ( i = 0; i < numRandom; i++ ) {
+		const uint64 firstPage = address / pageSize;
+		const uint64 numPages = (end - 1) / pageSize - firstPage + 1;
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		pages.push_back((firstPage + random % numPages) * pageSize);
+	}
+	std::sort(pages.begin(), pages.end());
+	pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+	// Read runs of adjacent pages in one go
+	uint8 *const buffer = new uint8[SAMPLE_CHUNK + pageSize];
+	ArrayJanitor<uint8> bufJan(buffer);
+	for ( i = 0; i < pages.size(); i = j ) {
+		const uint64 runStart = (pages[i] < address) ? address : pages[i];
+		uint64 runEnd;
+		for (
+			j = i + 1;
+			j < pages.size() && pages[j] == pages[j - 1] + pageSize && pages[j] - pages[i] < SAMPLE_CHUNK;
+			j++
+		);
+		runEnd = pages[j - 1] + pageSize;
+		if ( runEnd > end ) {
+			runEnd = end;
+		}
+		readMapped(runStart, runEnd - runStart, buffer);
+		numReads++;
+		checked += runEnd - runStart;
+		if ( memcmp(buffer, data + (runStart - address), (size_t)(runEnd - runStart)) ) {
+			uint64 k;
+			for ( k = runStart; buffer[k - runStart] == data[k - address]; k++ );
+			m_blockMap.find(k, &region);
+			if ( failed.empty() || failed.back() != region.address ) {
+				printf(
+					"Mismatch at 0x%08llX: expected 0x%02X, got 0x%02X\n",
+					(unsigned long long)k, data[k - address], buffer[k - runStart]
+				);
+				failed.push_back(region.address);
+			}
+		}
+	}
+	printf(
+		"Checked 0x%08llX bytes (%.1f%%) in %u reads, covering the ends of every region\n",
+		(unsigned long long)checked, 100.0 * (double)checked / (double)length, numReads
+	);
+	if ( !failed.empty() ) {
 		char msg[256];
+		if ( escalate ) {
+			// Check every byte of the failing regions, to report the full extent
+			for ( i = 0; i < failed.size(); i++ ) {
+				const uint64 start = (failed[i] < address) ? address : failed[i];
+				m_blockMap.find(failed[i], &region);
+				const uint64 stop = (region.address + region.size < end) ? region.address + region.size : end;
+				printf("Checking the whole region at 0x%08llX...\n", (unsigned long long)region.address);
+				verifyRegion(start, data + (start - address), (uint32)(stop - start));
+			}
+		}
 		sprintf(
 			msg,
-			"RegionProgrammer::read(): Requested %u bytes at address %u from a device with a capacity of only %u bytes!",
-			length, address, 1024 * m_flashChip->kbCapacity
+			"RegionProgrammer::sampledVerify(): Verification failed in %u region%s, the first at 0x%08llX!",
+			(uint32)failed.size(), (failed.size() == 1) ? "" : "s", (unsigned long long)failed[0]
 		);
 		throw GordonException(msg);
 	}
-	m_flashChip->readFunc(m_flashChip, m_transport, address, length, buffer);
+}
+
+void RegionProgrammer::digest(
+	uint64 address, uint64 length, std::vector<RegionDigest> &regions, uint32 *crc, uint8 *sha256)
+{
+	printf(
+		"Hashing 0x%08llX bytes from address 0x%08llX...\n",
+		(unsigned long long)length, (unsigned long long)address
+	);
+	EraseBlockMap::const_iterator it, last;
+	Sha256 sha;
+	checkCapacity("digest", address, length);
+	uint8 *const buffer = new uint8[DIGEST_CHUNK];
+	ArrayJanitor<uint8> bufJan(buffer);
+	regions.clear();
+	*crc = 0;
+	for ( it = m_blockMap.lowerBound(address), last = m_blockMap.upperBound(address, length); it != last; ++it ) {
+		const uint64 regionEnd = it->address + it->size;
+		RegionDigest region;
+		uint32 done, chunkLength;
+		region.address = address;
+		region.length = (uint32)((regionEnd - address < length) ? regionEnd - address : length);
+		region.crc = 0;
+		for ( done = 0; done < region.length; done += chunkLength ) {
+			chunkLength = (region.length - done > DIGEST_CHUNK) ? DIGEST_CHUNK : region.length - done;
+			readMapped(address + done, chunkLength, buffer);
+			region.crc = crc32c(region.crc, buffer, chunkLength);
+			*crc = crc32c(*crc, buffer, chunkLength);
+			sha.update(buffer, chunkLength);
+		}
+		regions.push_back(region);
+		address += region.length;
+		length -= region.length;
+	}
+	sha.final(sha256);
+}
+
+bool RegionProgrammer::priorityRead(uint64 address, uint64 length, uint8 *buffer) {
+	PendingRead request;
+	checkCapacity("priorityRead", address, length);
+	request.address = address;
+	request.length = length;
+	request.buffer = buffer;
+	request.done = false;
+	{
+		LockJanitor lock(m_readMutex);
+		if ( !m_writing ) {
+			return false;
+		}
+		m_readQueue.push_back(&request);
+		while ( !request.done ) {
+			m_readDone.wait(m_readMutex);
+		}
+	}
+	if ( !request.error.empty() ) {
+		throw GordonException(request.error);
+	}
+	return true;
 }
@@ -17,12 +17,27 @@
 #ifndef REGION_PROGRAMMER_H
 #define REGION_PROGRAMMER_H
 
+#include <vector>
+#include <deque>
+#include <string>
 #include "region_walker.h"
+#include "flash_chips.h"
+#include "sync.h"
 
 // Forward-declarations
 //
 class Transport;
-struct FlashChip;
+class FlashBaseline;
+class WriteJournal;
+class FileLoader;
+
+// The CRC-32C of the part of one erase region covered by a digest().
+//
+struct RegionDigest {
+	uint64 address;
+	uint32 length;
+	uint32 crc;
+};
 
 // The RegionProgrammer is the core of the flash programmer. It has a couple of
 // public methods, one for reading and one for writing. The former just
@@ -34,23 +49,140 @@ struct FlashChip;
 // support page-level erasure, which just means the callback() is only expected
 // to write one page on each call; other devices have more granular erasure
 // regions (e.g 64KiB), so for them, the callback() is expected to erase its
-// region and then write many pages.
+// region and then write many pages. Chips with page-level erasure may also
+// offer a BulkWrite mechanism; the callback() uses that for any page lying in a
+// bulk block which is entirely covered by the write. Chips which can patch a
+// page in place (i.e Atmel DataFlash) use that for an unaligned start and for a
+// partial last page, so the bytes around the data are preserved; for the rest,
+// the start must be aligned and the last page is padded with 0xFF.
+//
+// Chips which may have bad blocks (i.e SPI NAND) are addressed through a map of
+// good blocks: the Nth block of flash addresses is the Nth good block, so bad
+// blocks are skipped on writing and reading alike. The map is built lazily, so
+// only the blocks up to the highest address accessed are checked.
+//
+// Whilst a write is in progress, other threads may submit priority reads. These
+// are serviced by the writing thread between page programs and, on chips which
+// can suspend an erase, during erases too. Reads overlapping the region being
+// erased must wait for the erase to finish.
 // 
 class RegionProgrammer : public RegionWalker {
+	struct PendingRead {
+		uint64 address;
+		uint64 length;
+		uint8 *buffer;
+		bool done;
+		std::string error;
+	};
 	const Transport *m_transport;
 	const uint8 *m_dataPtr;
 	uint32 m_dotCount;
-	void callback(uint32 blockAddress, uint32 bytesUsed);
+	uint64 m_bulkStart;
+	uint64 m_bulkEnd;
+	bool m_bulkPending;
+	std::vector<uint64> m_goodBlocks;
+	uint64 m_nextBlock;
+	Mutex m_readMutex;
+	Condition m_readDone;
+	std::deque<PendingRead *> m_readQueue;
+	bool m_writing;
+	uint64 m_eraseTime;
+	uint32 m_eraseCount;
+	uint64 m_programTime;
+	uint32 m_programCount;
+	FlashBaseline *m_baseline;
+	uint32 m_skipCount;
+	bool m_verify;
+	WriteJournal *m_journal;
+	FileLoader *m_loader;
+	void callback(uint64 blockAddress, uint32 blockSize, uint32 bytesUsed);
+	void waitForData(uint32 length);
+	void eraseBlock(uint64 address, uint32 blockSize);
+	void programPage(PageProgramFunc progFunc, uint64 address, uint32 length);
+	void patchPage(uint64 address, uint32 length);
+	void programRegion(PageProgramFunc progFunc, uint64 address, uint32 length, bool erased);
+	bool verifyRegion(uint64 address, const uint8 *data, uint32 length);
+	void checkCapacity(const char *caller, uint64 address, uint64 length) const;
+	uint64 physicalAddress(uint64 address);
+	void readMapped(uint64 address, uint64 length, uint8 *buffer);
+	bool readsPending(uint64 avoidStart, uint64 avoidEnd);
+	void serviceReads(uint64 avoidStart, uint64 avoidEnd);
+	void abortReads();
 public:
-	explicit RegionProgrammer(const Transport *transport, const FlashChip *thisChip) :
-		RegionWalker(thisChip), m_transport(transport)
-	{ }
+	// Construction and destruction put the chip into and out of any mode its
+	// erase, program and read functions need (e.g 4-byte addressing).
+	explicit RegionProgrammer(const Transport *transport, const FlashChip *thisChip);
+	~RegionProgrammer();
 
 	// Public API: write "length" bytes of data from the supplied array to a
 	// given flash byte-address, and read back "length" bytes from a given byte-
-	// address into a supplied array.
-	void write(uint32 address, uint32 length, const uint8 *data);
-	void read(uint32 address, uint32 length, uint8 *buffer);
+	// address into a supplied array. The verify() method checks that the flash
+	// matches the supplied array, throwing if not. Chips which can compare pages
+	// on-chip do so; for the rest the data is read back and compared here.
+	//
+	// Given a journal, write() records each region in it as it is completed. If
+	// the journal shows an earlier attempt at the same write got part of the way,
+	// the last region it completed is read back, and the write carries on after it
+	// (or from it, if it does not match).
+	void write(uint64 address, uint64 length, const uint8 *data, WriteJournal *journal = NULL);
+	void read(uint64 address, uint64 length, uint8 *buffer);
+	void verify(uint64 address, uint64 length, const uint8 *data);
+
+	// As read(), but without reporting it, for callers which make many reads.
+	void fetch(uint64 address, uint64 length, uint8 *buffer);
+
+	// A quicker, statistical verify: compare only the first and last page of each
+	// erase region, and "numRandom" other pages chosen at random, reading runs of
+	// adjacent pages together, and report how much of the data was checked. If
+	// "escalate" is set, the whole of each region with a mismatch is then checked
+	// to report the full extent of the damage. Throws if there was a mismatch.
+	void sampledVerify(uint64 address, uint64 length, const uint8 *data, uint32 numRandom, bool escalate);
+
+	// Checksums only: read "length" bytes from a given byte-address in chunks,
+	// giving the CRC-32C and SHA-256 (SHA256_LENGTH bytes) of the whole range and
+	// the CRC-32C of each erase region within it, using a fixed-size buffer.
+	void digest(
+		uint64 address, uint64 length, std::vector<RegionDigest> &regions, uint32 *crc, uint8 *sha256
+	);
+
+	// Priority read, for use by threads other than the one calling write(). If a
+	// write is in progress, the read is queued for the writing thread to service
+	// at its next opportunity, and this method blocks until it has been, then
+	// returns true. If no write is in progress it returns false immediately, and
+	// the caller should use read() instead.
+	bool priorityRead(uint64 address, uint64 length, uint8 *buffer);
+
+	// Verification as part of writing: each region is read back and compared as
+	// soon as it has been programmed, with the ranges which differ reported. A
+	// region which fails is rewritten once; if it fails again, write() throws.
+	// Regions skipped thanks to a baseline are not read back.
+	void setVerify(bool verify);
+
+	// Differential writes: given a baseline describing what is already on the
+	// flash, write() skips the regions which would not change, and the erase of
+	// regions which are already erased, keeping the baseline up to date as it
+	// goes. Before relying on a baseline, checkBaseline() reads back a sample of
+	// the pages it claims to know; if any is wrong, the baseline is cleared and
+	// false is returned. The baseline is not owned by the RegionProgrammer.
+	void setBaseline(FlashBaseline *baseline);
+	bool checkBaseline(uint32 numSamples);
+
+	// Streaming: the data given to write() lies in the loader's buffer, and is
+	// still being loaded. Each region waits for its own bytes, so erasing and
+	// programming overlap the loading. The loader is not owned by the
+	// RegionProgrammer.
+	void setLoader(FileLoader *loader);
+
+	// The erase and page-program times observed so far, averaged over all the
+	// erases and page programs which ran to completion, or zero if there were
+	// none. These include the Transport's overheads, so they are what a write
+	// will actually see.
+	uint32 eraseTimeMs() const;
+	uint32 programTimeUs() const;
+
+	// Measure the link by timing a read of "length" bytes from the start of the
+	// flash, returning the bytes per second, or zero if it was too quick to time.
+	uint32 readBytesPerSecond(uint32 length);
 };
 
 #endif
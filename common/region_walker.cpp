@@ -20,13 +20,10 @@
 #include "flash_chips.h"
 #include "region_walker.h"
 
-void RegionWalker::walkRegions(uint32 dataAddress, uint32 dataLength) {
-	const EraseRegions *eraseRegions = &m_flashChip->eraseRegions[0];
-	uint32 cumulativeAddr = 0;
-	uint32 regionGroupsRemaining = NUM_ERASEREGIONS;
-	uint32 regionsRemaining = eraseRegions->count;
-	uint32 regionSize = eraseRegions->size;
-	if ( dataAddress + dataLength > 1024 * m_flashChip->kbCapacity ) {
+void RegionWalker::walkRegions(uint64 dataAddress, uint64 dataLength) {
+	EraseBlockMap::const_iterator it, end;
+	const uint64 capacity = (uint64)1024 * m_flashChip->kbCapacity;
+	if ( dataLength > capacity || dataAddress > capacity - dataLength ) {
 		char msg[256];
 		sprintf(
 			msg,
@@ -35,39 +32,19 @@ void RegionWalker::walkRegions(uint32 dataAddress, uint32 dataLength) {
 		);
 		throw GordonException(msg);
 	}
-	while ( regionGroupsRemaining && cumulativeAddr < dataAddress ) {
-		if ( !regionsRemaining ) {
-			regionGroupsRemaining--;
-			eraseRegions++;
-			regionsRemaining = eraseRegions->count;
-			regionSize = eraseRegions->size;
-		}
-		cumulativeAddr += regionSize;
-		regionsRemaining--;
-	}
-	if ( cumulativeAddr > dataAddress ) {
+	it = m_blockMap.lowerBound(dataAddress);
+	if ( it != m_blockMap.end() && it->address != dataAddress ) {
 		char msg[256];
 		sprintf(
 			msg,
-			"RegionWalker::walkRegions(): Address alignment error! The nearest aligned addresses are 0x%08X and 0x%08X.",
-			cumulativeAddr - regionSize, cumulativeAddr
+			"RegionWalker::walkRegions(): Address alignment error! The nearest aligned addresses are 0x%08llX and 0x%08llX.",
+			(unsigned long long)it->address, (unsigned long long)(it->address + it->size)
 		);
 		throw GordonException(msg);
 	}
-	dataAddress += dataLength;
-	while ( regionGroupsRemaining && cumulativeAddr < dataAddress ) {
-		if ( !regionsRemaining ) {
-			regionGroupsRemaining--;
-			eraseRegions++;
-			regionsRemaining = eraseRegions->count;
-			regionSize = eraseRegions->size;
-		}
-		callback(
-			cumulativeAddr,
-			(dataLength > regionSize) ? regionSize : dataLength
-		);
-		cumulativeAddr +=regionSize;
-		dataLength -= regionSize;
-		regionsRemaining--;
+	for ( end = m_blockMap.upperBound(dataAddress, dataLength); it != end; ++it ) {
+		const uint32 bytesUsed = (dataLength > it->size) ? it->size : (uint32)dataLength;
+		callback(it->address, it->size, bytesUsed);
+		dataLength -= bytesUsed;
 	}
 }
@@ -18,6 +18,7 @@
 #define REGION_WALKER_H
 
 #include <makestuff.h>
+#include "erase_block_map.h"
 
 struct FlashChip;
 
@@ -27,23 +28,26 @@ struct FlashChip;
  * important - many flash chips can only be erased at a fairly coarse level of
  * granularity like 64KiB. So the idea is you call walkRegions() with the range
  * of addresses you're interested in, and you'll get callbacks on callback()
- * for each region covered.
+ * for each region covered. Derived classes can also query the layout directly
+ * through m_blockMap.
  */
 class RegionWalker {
 protected:
 	const FlashChip *const m_flashChip;
+	const EraseBlockMap m_blockMap;
 private:
 	// Don't allow copy-ctor or assignment
 	RegionWalker(const RegionWalker &other);
 	RegionWalker &operator=(const RegionWalker &other);
 	
 	// Pure virtual callback() function, to be implemented by derived classes.
-	virtual void callback(uint32 blockAddress, uint32 bytesUsed) = 0;
+	virtual void callback(uint64 blockAddress, uint32 blockSize, uint32 bytesUsed) = 0;
 public:
 	// Public API: construct from a FlashChip, and walk its regions covering a
 	// given address range.
-	explicit RegionWalker(const FlashChip *flashChip) : m_flashChip(flashChip) { }
-	void walkRegions(uint32 dataAddress, uint32 dataLength);
+	explicit RegionWalker(const FlashChip *flashChip) : m_flashChip(flashChip), m_blockMap(flashChip) { }
+	virtual ~RegionWalker() { }
+	void walkRegions(uint64 dataAddress, uint64 dataLength);
 };
 
 #endif
@@ -0,0 +1,296 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstdio>
+#include <cstring>
+#include "flash_chips.h"
+#include "shadow_image.h"
+#include "hash.h"
+#include "util.h"
+
+using namespace std;
+
+// The file holds this header, then a known flag for each page, then the
+// contents of the whole chip. It is stored little-endian, so any host can read
+// it. The hash covers everything after the header; the state is nonzero from
+// the first change in a session until the changes are saved.
+//
+#define HDR_MAGIC     0
+#define HDR_VENDORID  8
+#define HDR_DEVICEID  12
+#define HDR_CAPACITY  16
+#define HDR_PAGESIZE  24
+#define HDR_NUMPAGES  28
+#define HDR_STATE     32
+#define HDR_SHA256    36
+#define HDR_LENGTH    (HDR_SHA256 + SHA256_LENGTH)
+static const char shadowMagic[8] = {'G', 'O', 'R', 'D', 'S', 'H', 'D', '2'};
+
+ShadowImage::ShadowImage(const char *fileName, const FlashChip *flashChip) :
+	m_fileName(fileName),
+	m_vendorID(flashChip->vendorID),
+	m_deviceID(flashChip->deviceID),
+	m_capacity((uint64)1024 * flashChip->kbCapacity),
+	m_pageSize(flashChip->pageSize),
+	m_numPages((uint32)(m_capacity / flashChip->pageSize)),
+	m_known(m_numPages, 0),
+	m_dirty(m_numPages, 0),
+	m_rewrite(false),
+	m_changing(false),
+	m_random((uint32)microseconds() | 1)
+{
+	load();
+}
+
+void ShadowImage::allocate() {
+	if ( m_contents.empty() ) {
+		m_contents.assign((size_t)m_capacity, 0xFF);
+	}
+}
+
+// The header for the current contents, with the hash left blank if they are
+// being changed.
+void ShadowImage::makeHeader(uint8 *header, bool changing) const {
+	memset(header, 0, HDR_LENGTH);
+	memcpy(header + HDR_MAGIC, shadowMagic, sizeof(shadowMagic));
+	putLE32(header + HDR_VENDORID, m_vendorID);
+	putLE32(header + HDR_DEVICEID, m_deviceID);
+	putLE64(header + HDR_CAPACITY, m_capacity);
+	putLE32(header + HDR_PAGESIZE, m_pageSize);
+	putLE32(header + HDR_NUMPAGES, m_numPages);
+	putLE32(header + HDR_STATE, changing ? 1 : 0);
+	if ( !changing ) {
+		Sha256 sha;
+		sha.update(&m_known[0], m_numPages);
+		sha.update(&m_contents[0], (size_t)m_capacity);
+		sha.final(header + HDR_SHA256);
+	}
+}
+
+void ShadowImage::load() {
+	uint8 header[HDR_LENGTH], digest[SHA256_LENGTH];
+	FILE *const file = fopen(m_fileName.c_str(), "rb");
+	if ( !file ) {
+		m_rewrite = true;
+		return;
+	}
+	if (
+		fread(header, HDR_LENGTH, 1, file) != 1 ||
+		memcmp(header + HDR_MAGIC, shadowMagic, sizeof(shadowMagic)) ||
+		getLE32(header + HDR_VENDORID) != m_vendorID || getLE32(header + HDR_DEVICEID) != m_deviceID ||
+		getLE64(header + HDR_CAPACITY) != m_capacity || getLE32(header + HDR_PAGESIZE) != m_pageSize ||
+		getLE32(header + HDR_NUMPAGES) != m_numPages || getLE32(header + HDR_STATE) != 0 )
+	{
+		fclose(file);
+		m_rewrite = true;
+		return;
+	}
+	allocate();
+	if (
+		fread(&m_known[0], 1, m_numPages, file) == m_numPages &&
+		fread(&m_contents[0], 1, (size_t)m_capacity, file) == (size_t)m_capacity )
+	{
+		Sha256 sha;
+		sha.update(&m_known[0], m_numPages);
+		sha.update(&m_contents[0], (size_t)m_capacity);
+		sha.final(digest);
+		if ( !memcmp(digest, header + HDR_SHA256, SHA256_LENGTH) ) {
+			fclose(file);
+			return;
+		}
+	}
+	fclose(file);
+	m_known.assign(m_numPages, 0);
+	vector<uint8>().swap(m_contents);
+	m_rewrite = true;
+}
+
+// Mark the file as being written, before the first change in a session, so it
+// is not trusted if the changes never get saved. A file which is not valid now
+// will not be trusted anyway. If the mark cannot be made, the file is removed.
+void ShadowImage::markChanging() {
+	uint8 header[HDR_LENGTH];
+	FILE *file;
+	if ( m_changing || m_rewrite ) {
+		return;
+	}
+	m_changing = true;
+	makeHeader(header, true);
+	file = fopen(m_fileName.c_str(), "r+b");
+	if ( file ) {
+		const bool ok = fwrite(header, HDR_LENGTH, 1, file) == 1 && syncFile(file);
+		if ( !fclose(file) && ok ) {
+			return;
+		}
+	}
+	fprintf(stderr, "Warning: unable to mark shadow image %s; removing it\n", m_fileName.c_str());
+	remove(m_fileName.c_str());
+	m_rewrite = true;
+}
+
+void ShadowImage::save() {
+	uint8 header[HDR_LENGTH];
+	FILE *file;
+	bool ok = true;
+	uint32 i, j;
+	if ( m_contents.empty() ) {
+		return;  // nothing was ever known
+	}
+	makeHeader(header, false);
+	if ( m_rewrite ) {
+		file = fopen(m_fileName.c_str(), "wb");
+		if ( !file ) {
+			fprintf(stderr, "Warning: unable to write shadow image %s\n", m_fileName.c_str());
+			return;
+		}
+		ok = ok && fwrite(header, HDR_LENGTH, 1, file) == 1;
+		ok = ok && fwrite(&m_known[0], 1, m_numPages, file) == m_numPages;
+		ok = ok && fwrite(&m_contents[0], 1, (size_t)m_capacity, file) == (size_t)m_capacity;
+	} else {
+		if ( !m_changing ) {
+			return;  // nothing changed
+		}
+		const uint64 contentsOffset = HDR_LENGTH + (uint64)m_numPages;
+		file = fopen(m_fileName.c_str(), "r+b");
+		if ( !file ) {
+			fprintf(stderr, "Warning: unable to write shadow image %s\n", m_fileName.c_str());
+			return;
+		}
+		for ( i = 0; ok && i < m_numPages; i = j ) {
+			if ( !m_dirty[i] ) {
+				j = i + 1;
+				continue;
+			}
+			for ( j = i; j < m_numPages && m_dirty[j]; j++ );
+			ok = seekFile(file, contentsOffset + (uint64)i * m_pageSize);
+			ok = ok && fwrite(&m_contents[(size_t)i * m_pageSize], m_pageSize, j - i, file) == j - i;
+		}
+		ok = ok && seekFile(file, HDR_LENGTH);
+		ok = ok && fwrite(&m_known[0], 1, m_numPages, file) == m_numPages;
+
+		// The contents must be on the disk before the header says they are valid
+		ok = ok && syncFile(file);
+		ok = ok && seekFile(file, 0);
+		ok = ok && fwrite(header, HDR_LENGTH, 1, file) == 1;
+	}
+	ok = ok && syncFile(file);
+	if ( fclose(file) || !ok ) {
+		fprintf(stderr, "Warning: unable to write shadow image %s\n", m_fileName.c_str());
+		return;
+	}
+	m_rewrite = false;
+	m_changing = false;
+	m_dirty.assign(m_numPages, 0);
+}
+
+bool ShadowImage::pagesKnown(uint64 address, uint64 length) const {
+	uint64 page;
+	if ( !length || length > m_capacity || address > m_capacity - length ) {
+		return false;
+	}
+	for ( page = address / m_pageSize; page <= (address + length - 1) / m_pageSize; page++ ) {
+		if ( !m_known[(size_t)page] ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ShadowImage::matches(uint64 address, uint32 regionSize, const uint8 *data, uint32 length) {
+	const uint8 *ptr;
+	uint32 i;
+	if ( !pagesKnown(address, regionSize) ) {
+		return false;
+	}
+	ptr = &m_contents[(size_t)address];
+	if ( memcmp(ptr, data, length) ) {
+		return false;
+	}
+	for ( i = length; i < regionSize && ptr[i] == 0xFF; i++ );
+	return i == regionSize;
+}
+
+bool ShadowImage::isErased(uint64 address, uint32 regionSize) {
+	const uint8 *ptr;
+	uint32 i;
+	if ( !pagesKnown(address, regionSize) ) {
+		return false;
+	}
+	ptr = &m_contents[(size_t)address];
+	for ( i = 0; i < regionSize && ptr[i] == 0xFF; i++ );
+	return i == regionSize;
+}
+
+void ShadowImage::forget(uint64 address, uint64 length) {
+	uint64 page;
+	if ( address >= m_capacity || !length ) {
+		return;
+	}
+	if ( length > m_capacity - address ) {
+		length = m_capacity - address;
+	}
+	markChanging();
+	for ( page = address / m_pageSize; page <= (address + length - 1) / m_pageSize; page++ ) {
+		m_known[(size_t)page] = 0;
+	}
+}
+
+void ShadowImage::update(uint64 address, uint32 regionSize, const uint8 *data, uint32 length) {
+	uint64 page;
+	if ( regionSize > m_capacity || address > m_capacity - regionSize || address % m_pageSize || regionSize % m_pageSize ) {
+		forget(address, regionSize);
+		return;
+	}
+	markChanging();
+	allocate();
+	memcpy(&m_contents[(size_t)address], data, length);
+	memset(&m_contents[(size_t)address + length], 0xFF, regionSize - length);
+	for ( page = address / m_pageSize; page < (address + regionSize) / m_pageSize; page++ ) {
+		m_known[(size_t)page] = 1;
+		m_dirty[(size_t)page] = 1;
+	}
+}
+
+uint32 ShadowImage::samplePages(uint64 *addresses, uint32 maxCount) {
+	uint32 numKnown = 0, count, i, page;
+	for ( i = 0; i < m_numPages; i++ ) {
+		numKnown += m_known[i];
+	}
+	if ( !numKnown ) {
+		return 0;
+	}
+	for ( count = 0; count < maxCount; count++ ) {
+		// Pick the Nth known page, for a pseudo-random N
+		m_random ^= m_random << 13;
+		m_random ^= m_random >> 17;
+		m_random ^= m_random << 5;
+		i = m_random % numKnown;
+		for ( page = 0; ; page++ ) {
+			if ( m_known[page] ) {
+				if ( !i ) {
+					break;
+				}
+				i--;
+			}
+		}
+		addresses[count] = (uint64)page * m_pageSize;
+	}
+	return count;
+}
+
+bool ShadowImage::checkPage(uint64 address, const uint8 *data) {
+	return !memcmp(&m_contents[(size_t)address], data, m_pageSize);
+}
@@ -0,0 +1,75 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef SHADOW_IMAGE_H
+#define SHADOW_IMAGE_H
+
+#include <string>
+#include <vector>
+#include "flash_baseline.h"
+
+// Forward-declarations
+//
+struct FlashChip;
+
+// A ShadowImage is a FlashBaseline kept in a file on the host: a copy of the
+// contents of one particular chip, as written by earlier sessions. Contents are
+// tracked page by page. The file has a SHA-256 of everything after its header,
+// so a damaged file is noticed on loading, and a file written for a different
+// kind of chip is ignored. The in-memory copy is only allocated once there is
+// something to keep.
+//
+// Before anything changes, the file is marked as being written, and the mark
+// is only cleared by a successful save(). So if the session dies part-way
+// through a write, leaving regions in an unknown state, the next session finds
+// the mark and discards the whole file rather than trusting it.
+//
+class ShadowImage : public FlashBaseline {
+	const std::string m_fileName;
+	const uint32 m_vendorID;
+	const uint32 m_deviceID;
+	const uint64 m_capacity;
+	const uint32 m_pageSize;
+	const uint32 m_numPages;
+	std::vector<uint8> m_contents;
+	std::vector<uint8> m_known;
+	std::vector<uint8> m_dirty;
+	bool m_rewrite;
+	bool m_changing;
+	uint32 m_random;
+	void load();
+	bool pagesKnown(uint64 address, uint64 length) const;
+	void allocate();
+	void makeHeader(uint8 *header, bool changing) const;
+	void markChanging();
+public:
+	// Construction loads the file, if it exists and suits the chip.
+	ShadowImage(const char *fileName, const FlashChip *flashChip);
+
+	// Write the changes back to the file. Failure is just a warning, because the
+	// shadow is only an optimisation.
+	void save();
+
+	// FlashBaseline implementation
+	bool matches(uint64 address, uint32 regionSize, const uint8 *data, uint32 length);
+	bool isErased(uint64 address, uint32 regionSize);
+	void forget(uint64 address, uint64 length);
+	void update(uint64 address, uint32 regionSize, const uint8 *data, uint32 length);
+	uint32 samplePages(uint64 *addresses, uint32 maxCount);
+	bool checkPage(uint64 address, const uint8 *data);
+};
+
+#endif
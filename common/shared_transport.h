@@ -0,0 +1,43 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef SHARED_TRANSPORT_H
+#define SHARED_TRANSPORT_H
+
+#include "transport.h"
+#include "sync.h"
+
+// A SharedTransport lets several threads, each driving a chip of its own, share
+// one underlying link (e.g several chip-selects behind one FPGALink conduit).
+// All the SharedTransports on a link share a TurnLock, and each message is sent
+// whole whilst holding it. Threads take turns in the order they asked, so one
+// polling a busy chip gives the others a turn between polls. The underlying
+// Transport is not owned by the SharedTransport.
+//
+class SharedTransport : public Transport {
+	const Transport *const m_transport;
+	TurnLock *const m_lock;
+	SharedTransport &operator=(const SharedTransport &other);
+	SharedTransport(const SharedTransport &other);
+public:
+	SharedTransport(const Transport *transport, TurnLock *lock) : m_transport(transport), m_lock(lock) { }
+	void sendMessage(
+		const uint8 *cmdData, uint32 cmdLength = 1,
+		uint8 *recvBuf = 0, uint32 recvLength = 0
+	) const;
+};
+
+#endif
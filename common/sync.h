@@ -0,0 +1,163 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef SYNC_H
+#define SYNC_H
+
+#ifdef WIN32
+	#include <Windows.h>
+#else
+	#include <pthread.h>
+#endif
+
+// Minimal wrappers for the synchronisation primitives needed when other threads
+// hand work to the thread which drives the Transport, and for starting threads.
+//
+class Mutex {
+#ifdef WIN32
+	CRITICAL_SECTION m_cs;
+#else
+	pthread_mutex_t m_mutex;
+#endif
+	Mutex &operator=(const Mutex &other);
+	Mutex(const Mutex &other);
+	friend class Condition;
+public:
+#ifdef WIN32
+	Mutex() { InitializeCriticalSection(&m_cs); }
+	~Mutex() { DeleteCriticalSection(&m_cs); }
+	void lock() { EnterCriticalSection(&m_cs); }
+	void unlock() { LeaveCriticalSection(&m_cs); }
+#else
+	Mutex() { pthread_mutex_init(&m_mutex, NULL); }
+	~Mutex() { pthread_mutex_destroy(&m_mutex); }
+	void lock() { pthread_mutex_lock(&m_mutex); }
+	void unlock() { pthread_mutex_unlock(&m_mutex); }
+#endif
+};
+
+class Condition {
+#ifdef WIN32
+	CONDITION_VARIABLE m_cond;
+#else
+	pthread_cond_t m_cond;
+#endif
+	Condition &operator=(const Condition &other);
+	Condition(const Condition &other);
+public:
+#ifdef WIN32
+	Condition() { InitializeConditionVariable(&m_cond); }
+	~Condition() { }
+	void wait(Mutex &mutex) { SleepConditionVariableCS(&m_cond, &mutex.m_cs, INFINITE); }
+	void broadcast() { WakeAllConditionVariable(&m_cond); }
+#else
+	Condition() { pthread_cond_init(&m_cond, NULL); }
+	~Condition() { pthread_cond_destroy(&m_cond); }
+	void wait(Mutex &mutex) { pthread_cond_wait(&m_cond, &mutex.m_mutex); }
+	void broadcast() { pthread_cond_broadcast(&m_cond); }
+#endif
+};
+
+// A thread running func(arg), which is joined on destruction if it has not been
+// already. If the thread could not be started, started() returns false.
+//
+class Thread {
+	void (*const m_func)(void *);
+	void *const m_arg;
+	bool m_running;
+#ifdef WIN32
+	HANDLE m_handle;
+	static DWORD WINAPI entry(LPVOID param) {
+		Thread *const self = (Thread *)param;
+		self->m_func(self->m_arg);
+		return 0;
+	}
+#else
+	pthread_t m_thread;
+	static void *entry(void *param) {
+		Thread *const self = (Thread *)param;
+		self->m_func(self->m_arg);
+		return NULL;
+	}
+#endif
+	Thread &operator=(const Thread &other);
+	Thread(const Thread &other);
+public:
+#ifdef WIN32
+	Thread(void (*func)(void *), void *arg) : m_func(func), m_arg(arg) {
+		m_handle = CreateThread(NULL, 0, entry, this, 0, NULL);
+		m_running = (m_handle != NULL);
+	}
+	void join() {
+		if ( m_running ) {
+			WaitForSingleObject(m_handle, INFINITE);
+			CloseHandle(m_handle);
+			m_running = false;
+		}
+	}
+#else
+	Thread(void (*func)(void *), void *arg) : m_func(func), m_arg(arg) {
+		m_running = (pthread_create(&m_thread, NULL, entry, this) == 0);
+	}
+	void join() {
+		if ( m_running ) {
+			pthread_join(m_thread, NULL);
+			m_running = false;
+		}
+	}
+#endif
+	~Thread() { join(); }
+	bool started() const { return m_running; }
+};
+
+// Janitor which holds a Mutex locked for as long as it is in scope.
+//
+class LockJanitor {
+	Mutex &m_mutex;
+	LockJanitor &operator=(const LockJanitor &other);
+	LockJanitor(const LockJanitor &other);
+public:
+	explicit LockJanitor(Mutex &mutex) : m_mutex(mutex) { m_mutex.lock(); }
+	~LockJanitor() { m_mutex.unlock(); }
+};
+
+// A lock which waiting threads acquire in the order they asked for it, so one
+// which releases it and immediately asks again cannot starve the others.
+//
+class TurnLock {
+	Mutex m_mutex;
+	Condition m_turn;
+	unsigned long m_nextTicket;
+	unsigned long m_nowServing;
+	TurnLock &operator=(const TurnLock &other);
+	TurnLock(const TurnLock &other);
+public:
+	TurnLock() : m_nextTicket(0), m_nowServing(0) { }
+	void lock() {
+		LockJanitor lock(m_mutex);
+		const unsigned long ticket = m_nextTicket++;
+		while ( m_nowServing != ticket ) {
+			m_turn.wait(m_mutex);
+		}
+	}
+	void unlock() {
+		LockJanitor lock(m_mutex);
+		m_nowServing++;
+		m_turn.broadcast();
+	}
+};
+
+#endif
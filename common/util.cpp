@@ -14,12 +14,15 @@
  * You should have received a copy of the GNU Lesser General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define _FILE_OFFSET_BITS 64
 #include <makestuff.h>
 #ifdef WIN32
 	#include <Windows.h>
+	#include <io.h>
 #else
 	#define _BSD_SOURCE
 	#include <unistd.h>
+	#include <sys/time.h>
 #endif
 #include <cstdio>
 #include <cstdlib>
@@ -66,6 +69,51 @@ bool startsWith(const char *s, const char *p) {
 	return (*p == '\0');
 }
 
+/*
+ * Parse an unsigned 64-bit number, in decimal, hex (with a leading "0x") or octal (with a leading
+ * "0"), like strtoul() with base zero. The location of the first unparsed character is written
+ * to the location pointed to by 'endPtr', if non-NULL. If the number overflows, nothing is
+ * parsed, so the caller sees the failure as a syntax error.
+ */
+uint64 parseUInt64(const char *str, const char **endPtr) {
+	const char *ptr = str;
+	uint64 base = 10;
+	uint64 value = 0;
+	uint64 digit;
+	if ( ptr[0] == '0' && (ptr[1] == 'x' || ptr[1] == 'X') ) {
+		base = 16;
+		ptr += 2;
+	} else if ( ptr[0] == '0' ) {
+		base = 8;
+	}
+	for ( ;; ) {
+		const char ch = *ptr;
+		if ( ch >= '0' && ch <= '9' ) {
+			digit = (uint64)(ch - '0');
+		} else if ( ch >= 'a' && ch <= 'f' ) {
+			digit = (uint64)(ch - 'a' + 10);
+		} else if ( ch >= 'A' && ch <= 'F' ) {
+			digit = (uint64)(ch - 'A' + 10);
+		} else {
+			break;
+		}
+		if ( digit >= base ) {
+			break;
+		}
+		if ( value > (~(uint64)0 - digit) / base ) {
+			value = 0;
+			ptr = str;
+			break;
+		}
+		value = value * base + digit;
+		ptr++;
+	}
+	if ( endPtr ) {
+		*endPtr = ptr;
+	}
+	return value;
+}
+
 static const uint8 swapTable[] = {
 	0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0, 0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0,
 	0x08, 0x88, 0x48, 0xC8, 0x28, 0xA8, 0x68, 0xE8, 0x18, 0x98, 0x58, 0xD8, 0x38, 0xB8, 0x78, 0xF8,
@@ -85,9 +133,69 @@ static const uint8 swapTable[] = {
 	0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF
 };
 
-void bitSwap(uint32 length, uint8 *buffer) {
+void bitSwap(size_t length, uint8 *buffer) {
 	while ( length-- ) {
 		*buffer = swapTable[*buffer];
 		buffer++;
 	}
 }
+
+// Elapsed time in microseconds, from an arbitrary origin; only differences
+// between two calls are meaningful.
+uint64 microseconds(void) {
+#ifdef WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64)count.QuadPart / (uint64)freq.QuadPart * 1000000 +
+		(uint64)count.QuadPart % (uint64)freq.QuadPart * 1000000 / (uint64)freq.QuadPart;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64)tv.tv_sec * 1000000 + (uint64)tv.tv_usec;
+#endif
+}
+
+// Little-endian serialisation, for files and flash structures which any host
+// must be able to read.
+void putLE32(uint8 *ptr, uint32 value) {
+	ptr[0] = (uint8)value;
+	ptr[1] = (uint8)(value >> 8);
+	ptr[2] = (uint8)(value >> 16);
+	ptr[3] = (uint8)(value >> 24);
+}
+
+void putLE64(uint8 *ptr, uint64 value) {
+	putLE32(ptr, (uint32)value);
+	putLE32(ptr + 4, (uint32)(value >> 32));
+}
+
+uint32 getLE32(const uint8 *ptr) {
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32)ptr[3] << 24);
+}
+
+uint64 getLE64(const uint8 *ptr) {
+	return getLE32(ptr) | ((uint64)getLE32(ptr + 4) << 32);
+}
+
+// Seek to a 64-bit offset from the start of the file, even where a long is only
+// 32 bits. Returns false on failure.
+bool seekFile(FILE *file, uint64 offset) {
+#ifdef WIN32
+	return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Flush the file's buffers all the way to the disk. Returns false on failure.
+bool syncFile(FILE *file) {
+	if ( fflush(file) ) {
+		return false;
+	}
+#ifdef WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
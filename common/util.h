@@ -1,10 +1,19 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <cstdio>
 #include <makestuff.h>
 
 uint8 *loadFile(const char *name, size_t *length);
 bool startsWith(const char *s, const char *p);
-void bitSwap(uint32 length, uint8 *buffer);
+uint64 parseUInt64(const char *str, const char **endPtr);
+void bitSwap(size_t length, uint8 *buffer);
+uint64 microseconds(void);
+void putLE32(uint8 *ptr, uint32 value);
+void putLE64(uint8 *ptr, uint64 value);
+uint32 getLE32(const uint8 *ptr);
+uint64 getLE64(const uint8 *ptr);
+bool seekFile(FILE *file, uint64 offset);
+bool syncFile(FILE *file);
 
 #endif
@@ -0,0 +1,151 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstring>
+#include "write_journal.h"
+#include "hash.h"
+#include "util.h"
+
+#define MAX_JOURNALLINE 1024
+
+using namespace std;
+
+// The file is text: for each run, a header line identifying the chip and the
+// data, then a line for each region completed. A line cut short by an
+// interruption lacks its newline, so is ignored.
+//
+static const char journalMagic[] = "gordon-journal";
+
+WriteJournal::WriteJournal(const char *fileName, const string &chipKey, bool resume) :
+	m_fileName(fileName), m_chipKey(chipKey), m_resume(resume), m_file(NULL), m_started(false)
+{ }
+
+WriteJournal::~WriteJournal() {
+	if ( m_file ) {
+		fclose(m_file);
+	}
+}
+
+string WriteJournal::header(uint64 address, uint64 length, const uint8 *data) const {
+	char line[MAX_JOURNALLINE];
+	uint8 sha256[SHA256_LENGTH];
+	char *ptr = line;
+	Sha256 hash;
+	uint32 i;
+	hash.update(data, (size_t)length);
+	hash.final(sha256);
+	ptr += sprintf(
+		ptr, "%s %.*s 0x%08llX 0x%08llX ", journalMagic, MAX_JOURNALLINE / 2, m_chipKey.c_str(),
+		(unsigned long long)address, (unsigned long long)length
+	);
+	for ( i = 0; i < SHA256_LENGTH; i++ ) {
+		ptr += sprintf(ptr, "%02X", sha256[i]);
+	}
+	sprintf(ptr, "\n");
+	return line;
+}
+
+void WriteJournal::load() {
+	char line[MAX_JOURNALLINE];
+	Progress *progress = NULL;
+	FILE *const file = fopen(m_fileName.c_str(), "r");
+	if ( !file ) {
+		return;
+	}
+	while ( fgets(line, MAX_JOURNALLINE, file) ) {
+		if ( startsWith(line, journalMagic) ) {
+			progress = &m_progress[line];
+			progress->length = 0;
+		} else if ( progress && startsWith(line, "done ") ) {
+			const char *ptr;
+			const uint64 address = parseUInt64(line + 5, &ptr);
+			uint64 length;
+			if ( *ptr == ' ' ) {
+				length = parseUInt64(ptr + 1, &ptr);
+				if ( *ptr == '\n' && length && length <= 0xFFFFFFFFU ) {
+					progress->address = address;
+					progress->length = (uint32)length;
+				}
+			}
+		}
+	}
+	fclose(file);
+}
+
+bool WriteJournal::begin(uint64 address, uint64 length, const uint8 *data, uint64 *lastAddress, uint32 *lastLength) {
+	const string expected = header(address, length, data);
+	map<string, Progress>::const_iterator it;
+	bool found = false;
+	if ( !m_started ) {
+		// The first run of the write: either carry on appending to the file, or
+		// start it afresh.
+		m_started = true;
+		if ( m_resume ) {
+			load();
+		}
+		m_file = fopen(m_fileName.c_str(), m_resume ? "a" : "w");
+		if ( !m_file ) {
+			fprintf(stderr, "Warning: unable to write journal %s\n", m_fileName.c_str());
+		} else if ( m_resume ) {
+			fputs("\n", m_file);  // ending any line cut short
+		}
+	}
+	it = m_progress.find(expected);
+	if ( it != m_progress.end() && it->second.length ) {
+		const Progress &progress = it->second;
+		if ( progress.address >= address && progress.address + progress.length <= address + length ) {
+			*lastAddress = progress.address;
+			*lastLength = progress.length;
+			found = true;
+		}
+	}
+	if ( m_resume && !found ) {
+		printf("The journal records no progress on this run; writing it in full\n");
+	}
+	if ( m_file ) {
+		fputs(expected.c_str(), m_file);
+		if ( found ) {
+			completed(*lastAddress, *lastLength);
+		} else if ( fflush(m_file) ) {
+			fprintf(stderr, "Warning: unable to write journal %s\n", m_fileName.c_str());
+			fclose(m_file);
+			m_file = NULL;
+		}
+	}
+	return found;
+}
+
+void WriteJournal::completed(uint64 address, uint32 length) {
+	if ( !m_file ) {
+		return;
+	}
+	fprintf(m_file, "done 0x%08llX 0x%08X\n", (unsigned long long)address, length);
+	if ( fflush(m_file) ) {
+		fprintf(stderr, "Warning: unable to write journal %s\n", m_fileName.c_str());
+		fclose(m_file);
+		m_file = NULL;
+	}
+}
+
+void WriteJournal::finish() {
+	if ( m_file ) {
+		fclose(m_file);
+		m_file = NULL;
+	}
+	remove(m_fileName.c_str());
+	m_progress.clear();
+	m_started = false;
+}
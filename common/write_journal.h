@@ -0,0 +1,65 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef WRITE_JOURNAL_H
+#define WRITE_JOURNAL_H
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <makestuff.h>
+
+// A WriteJournal is a small file on the host recording the progress of a write,
+// so a write which is interrupted (e.g because the link dropped) can be resumed
+// rather than started again. For each run of data written, it identifies the
+// chip and the data, then lists each region of the run as it is completed,
+// flushing the file after each one. Regions are completed in address order, so
+// the last one listed marks where the run got to.
+//
+class WriteJournal {
+	struct Progress {
+		uint64 address;
+		uint32 length;
+	};
+	const std::string m_fileName;
+	const std::string m_chipKey;
+	const bool m_resume;
+	FILE *m_file;
+	bool m_started;
+	std::map<std::string, Progress> m_progress;
+	std::string header(uint64 address, uint64 length, const uint8 *data) const;
+	void load();
+	WriteJournal &operator=(const WriteJournal &other);
+	WriteJournal(const WriteJournal &other);
+public:
+	// The chip is identified by "chipKey" (e.g its JEDEC and unique IDs). Unless
+	// "resume" is set, any earlier journal is ignored.
+	WriteJournal(const char *fileName, const std::string &chipKey, bool resume);
+	~WriteJournal();
+
+	// Start journalling a run. If resuming, and the file records progress on the
+	// same run to the same chip, return true with the range of the last region
+	// it completed, and carry on from there; otherwise start the run afresh.
+	bool begin(uint64 address, uint64 length, const uint8 *data, uint64 *lastAddress, uint32 *lastLength);
+
+	// The "length" bytes at "address" have been written.
+	void completed(uint64 address, uint32 length);
+
+	// The write was successful, so the journal is no longer needed, and is deleted.
+	void finish();
+};
+
+#endif
@@ -0,0 +1,221 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#include <cstdio>
+#include "exception.h"
+#include "flash_chips.h"
+#include "flash_baseline.h"
+#include "write_planner.h"
+
+// Bytes sent over the link for a command with an address (e.g an erase), not
+// counting its data.
+#define PLAN_CMD_BYTES 5
+
+WritePlan::WritePlan() :
+	eraseCount(0), pageCount(0), skipCount(0), bytesWritten(0), bytesRead(0),
+	eraseTimeMs(0), programTimeUs(0), bytesPerSecond(0)
+{ }
+
+WritePlanner::WritePlanner(const FlashChip *flashChip, FlashBaseline *baseline, bool verify) :
+	RegionWalker(flashChip), m_baseline(baseline), m_verify(verify), m_plan(NULL), m_dataPtr(NULL),
+	m_bulkStart(0), m_bulkEnd(0)
+{ }
+
+// Mirrors RegionProgrammer::callback().
+void WritePlanner::callback(uint64 blockAddress, uint32 blockSize, uint32 bytesUsed) {
+	const uint32 pageSize = m_flashChip->pageSize;
+	const BulkWrite *const bulkWrite = m_flashChip->bulkWrite;
+	uint64 bulkAddress = 0, bulkSize = 0;
+	uint32 done, chunkLength;
+	bool erased = false;
+	PlanStep step;
+	step.address = blockAddress;
+	step.size = blockSize;
+	step.pages = 0;
+	if ( m_baseline ) {
+		if ( m_baseline->matches(blockAddress, blockSize, m_dataPtr, bytesUsed) ) {
+			step.action = PLAN_SKIP;
+			m_plan->steps.push_back(step);
+			m_plan->skipCount++;
+			m_dataPtr += bytesUsed;
+			return;
+		}
+		erased = m_baseline->isErased(blockAddress, blockSize);
+	}
+	if ( bulkWrite ) {
+		bulkSize = bulkWrite->blockPages * pageSize;
+		bulkAddress = blockAddress - blockAddress % bulkSize;
+	}
+	if ( bulkSize && bulkAddress >= m_bulkStart && bulkAddress + bulkSize <= m_bulkEnd ) {
+		step.action = PLAN_BULK;
+		if ( blockAddress == bulkAddress ) {
+			m_plan->eraseCount++;
+			m_plan->bytesWritten += PLAN_CMD_BYTES;
+		}
+	} else if ( erased ) {
+		step.action = PLAN_PROGRAM;
+	} else {
+		step.action = PLAN_ERASE;
+		m_plan->eraseCount++;
+		m_plan->bytesWritten += PLAN_CMD_BYTES;
+	}
+	for ( done = 0; done < bytesUsed; done += chunkLength ) {
+		uint32 i = 0;
+		chunkLength = (bytesUsed - done > pageSize) ? pageSize : bytesUsed - done;
+		if ( erased ) {
+			for ( i = 0; i < chunkLength && m_dataPtr[done + i] == 0xFF; i++ );
+		}
+		if ( i < chunkLength ) {
+			step.pages++;
+			m_plan->bytesWritten += chunkLength + PLAN_CMD_BYTES;
+		}
+	}
+	if ( m_verify ) {
+		m_plan->bytesWritten += PLAN_CMD_BYTES;
+		m_plan->bytesRead += bytesUsed;
+	}
+	m_plan->pageCount += step.pages;
+	m_plan->steps.push_back(step);
+	m_dataPtr += bytesUsed;
+}
+
+// Mirrors RegionProgrammer::patchPage().
+void WritePlanner::patchStep(uint64 address, uint32 length) {
+	const uint32 pageSize = m_flashChip->pageSize;
+	const uint64 pageAddress = address - address % pageSize;
+	PlanStep step;
+	step.address = pageAddress;
+	step.size = pageSize;
+	step.pages = 0;
+	if ( m_baseline && pageAddress == address && m_baseline->matches(address, pageSize, m_dataPtr, length) ) {
+		step.action = PLAN_SKIP;
+		m_plan->skipCount++;
+	} else {
+		step.action = PLAN_PATCH;
+		step.pages = 1;
+		m_plan->pageCount++;
+		m_plan->bytesWritten += length + 3 * PLAN_CMD_BYTES;  // load, patch, commit
+		if ( m_verify ) {
+			m_plan->bytesWritten += PLAN_CMD_BYTES;
+			m_plan->bytesRead += length;
+		}
+		if ( m_baseline ) {
+			m_plan->bytesWritten += PLAN_CMD_BYTES;
+			m_plan->bytesRead += pageSize;
+		}
+	}
+	m_plan->steps.push_back(step);
+	m_dataPtr += length;
+}
+
+// Mirrors RegionProgrammer::write().
+void WritePlanner::plan(uint64 address, uint64 length, const uint8 *data, WritePlan &plan) {
+	const uint32 pageSize = m_flashChip->pageSize;
+	uint32 headLength = 0, tailLength = 0;
+	uint64 middleLength;
+	const uint64 capacity = (uint64)1024 * m_flashChip->kbCapacity;
+	if ( length > capacity || address > capacity - length ) {
+		char msg[256];
+		sprintf(
+			msg,
+			"WritePlanner::plan(): Address range error! This device's capacity is limited to %u KiB.",
+			m_flashChip->kbCapacity
+		);
+		throw GordonException(msg);
+	}
+	if ( m_flashChip->pagePatchFunc ) {
+		if ( address % pageSize ) {
+			headLength = pageSize - (uint32)(address % pageSize);
+			if ( headLength > length ) {
+				headLength = (uint32)length;
+			}
+		}
+		tailLength = (uint32)((length - headLength) % pageSize);
+	}
+	middleLength = length - headLength - tailLength;
+	m_bulkStart = address + headLength;
+	m_bulkEnd = m_baseline ? m_bulkStart : m_bulkStart + (middleLength + pageSize - 1) / pageSize * pageSize;
+	m_plan = &plan;
+	m_dataPtr = data;
+	if ( headLength ) {
+		patchStep(address, headLength);
+	}
+	if ( middleLength ) {
+		walkRegions(address + headLength, middleLength);
+	}
+	if ( tailLength ) {
+		patchStep(address + length - tailLength, tailLength);
+	}
+	m_plan = NULL;
+}
+
+void printWritePlan(const WritePlan &plan) {
+	static const char *const actionNames[] = {
+		"skip", "program", "erase and program", "bulk erase and program", "patch"
+	};
+	const uint64 linkBytes = plan.bytesWritten + plan.bytesRead;
+	double seconds = 0.0;
+	size_t i, j;
+	printf("Plan:\n");
+	for ( i = 0; i < plan.steps.size(); i = j ) {
+		uint32 pages = 0;
+		for (
+			j = i;
+			j < plan.steps.size() && plan.steps[j].action == plan.steps[i].action &&
+				(j == i || plan.steps[j].address == plan.steps[j - 1].address + plan.steps[j - 1].size);
+			j++ )
+		{
+			pages += plan.steps[j].pages;
+		}
+		printf(
+			"  0x%08llX-0x%08llX: %s %u %s%s",
+			(unsigned long long)plan.steps[i].address,
+			(unsigned long long)(plan.steps[j - 1].address + plan.steps[j - 1].size - 1),
+			actionNames[plan.steps[i].action], (uint32)(j - i),
+			(plan.steps[i].action == PLAN_PATCH) ? "page" : "region", (j - i == 1) ? "" : "s"
+		);
+		if ( pages && plan.steps[i].action != PLAN_PATCH ) {
+			printf(" (%u page program%s)", pages, (pages == 1) ? "" : "s");
+		}
+		printf("\n");
+	}
+	printf(
+		"Totals: %u erase%s, %u page program%s, %u region%s skipped\n",
+		plan.eraseCount, (plan.eraseCount == 1) ? "" : "s",
+		plan.pageCount, (plan.pageCount == 1) ? "" : "s",
+		plan.skipCount, (plan.skipCount == 1) ? "" : "s"
+	);
+	printf(
+		"Link: about 0x%08llX bytes written and 0x%08llX bytes read\n",
+		(unsigned long long)plan.bytesWritten, (unsigned long long)plan.bytesRead
+	);
+	seconds += plan.eraseCount * (plan.eraseTimeMs / 1000.0);
+	seconds += plan.pageCount * (plan.programTimeUs / 1000000.0);
+	if ( plan.bytesPerSecond ) {
+		seconds += (double)linkBytes / plan.bytesPerSecond;
+	}
+	printf("Estimated time: %.1fs", seconds);
+	if ( plan.eraseCount && !plan.eraseTimeMs ) {
+		printf(", plus %u erase%s of unknown duration", plan.eraseCount, (plan.eraseCount == 1) ? "" : "s");
+	}
+	if ( plan.pageCount && !plan.programTimeUs ) {
+		printf(", plus %u page program%s of unknown duration", plan.pageCount, (plan.pageCount == 1) ? "" : "s");
+	}
+	if ( !plan.bytesPerSecond ) {
+		printf(", plus the transfers");
+	}
+	printf("\n");
+}
@@ -0,0 +1,87 @@
+/* 
+ * Copyright (C) 2013 Chris McClelland
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+#ifndef WRITE_PLANNER_H
+#define WRITE_PLANNER_H
+
+#include <vector>
+#include "region_walker.h"
+
+// Forward-declarations
+//
+class FlashBaseline;
+
+// What a write would do to one erase region (or, for a patch, one page).
+//
+enum PlanAction {
+	PLAN_SKIP,     // unchanged, so left alone
+	PLAN_PROGRAM,  // already erased, so just programmed
+	PLAN_ERASE,    // erased with the chip's erase function, then programmed
+	PLAN_BULK,     // erased as part of a bulk block, then programmed
+	PLAN_PATCH     // part of a page patched in place
+};
+
+struct PlanStep {
+	uint64 address;
+	uint32 size;
+	uint32 pages;  // number of page programs
+	PlanAction action;
+};
+
+// The plan for one or more writes, with the totals needed to estimate its
+// duration. Link bytes are approximate: they count the commands, addresses and
+// data sent and received, but not status polling.
+//
+struct WritePlan {
+	std::vector<PlanStep> steps;
+	uint32 eraseCount;      // including bulk erases
+	uint32 pageCount;       // page programs and patches
+	uint32 skipCount;
+	uint64 bytesWritten;    // over the link
+	uint64 bytesRead;       // over the link
+	uint32 eraseTimeMs;     // from the chip, or zero if unknown
+	uint32 programTimeUs;   // from the chip, or zero if unknown
+	uint32 bytesPerSecond;  // measured on the link, or zero if unknown
+	WritePlan();
+};
+
+// The WritePlanner works out what RegionProgrammer::write() would do, given the
+// same chip, baseline and verify setting, without touching the flash. It walks
+// the regions just as the RegionProgrammer does, so it sees the same erases,
+// skips, bulk blocks and patched pages.
+//
+class WritePlanner : public RegionWalker {
+	FlashBaseline *const m_baseline;
+	const bool m_verify;
+	WritePlan *m_plan;
+	const uint8 *m_dataPtr;
+	uint64 m_bulkStart;
+	uint64 m_bulkEnd;
+	void callback(uint64 blockAddress, uint32 blockSize, uint32 bytesUsed);
+	void patchStep(uint64 address, uint32 length);
+public:
+	WritePlanner(const FlashChip *flashChip, FlashBaseline *baseline, bool verify);
+
+	// Add the steps of writing "length" bytes of data at "address" to the plan.
+	void plan(uint64 address, uint64 length, const uint8 *data, WritePlan &plan);
+};
+
+// Print the steps of a plan, merging runs of similar regions, then its totals and
+// the estimated duration.
+//
+void printWritePlan(const WritePlan &plan);
+
+#endif
@@ -21,21 +21,41 @@
 #include "exception.h"
 #include "transport_pcie.h"
 #include "flash_chips.h"
+#include "flash_device.h"
 #include "region_programmer.h"
+#include "hash.h"
+#include "write_planner.h"
+#include "composite_image.h"
+#include "bitstream.h"
+#include "file_loader.h"
 #include "janitors.h"
 #include "util.h"
 
 using namespace std;
 
+#define MAX_WRITES 16
+
 int main(int argc, char *argv[]) {
 	int retVal = 0;
 	struct arg_str *devOpt = arg_str0("d", "dev", "<devNode>", " device node (e.g /dev/fpgacam)");
-	struct arg_str *writeOpt = arg_str0("w", "write", "<f:a>", "   write file f to address a");
+	struct arg_str *writeOpt = arg_strn("w", "write", "<f:a>", 0, MAX_WRITES, "   write file f to address a (repeatable)");
 	struct arg_str *readOpt = arg_str0("r", "read", "<f:a:l>", "  read l bytes into file f from address a");
+	struct arg_str *hashOpt = arg_str0("x", "hash", "<a:l>", "    print checksums of l bytes from address a");
 	struct arg_lit *swapOpt = arg_lit0("s", "swap", "          bit-swap the flash data read or written");
+	struct arg_lit *verifyOpt = arg_lit0("y", "verify", "        verify the flash data as it is written");
+	struct arg_str *cacheOpt = arg_str0("c", "cache", "<file>", "  remember the chip in a cache file");
+	struct arg_lit *shadowOpt = arg_lit0("k", "shadow", "        keep a shadow copy of the chip beside the cache file");
+	struct arg_str *manifestOpt = arg_str0("m", "manifest", "<a>", "  keep a block-hash manifest at address a");
+	struct arg_lit *planOpt = arg_lit0("p", "plan", "          show what writing would do, without writing");
+	struct arg_int *sampleOpt = arg_int0("n", "sample", "<n>", "    verify sampled pages, n of them at random");
+	struct arg_lit *escalateOpt = arg_lit0("e", "escalate", "      fully check regions failing a sampled verify");
+	struct arg_lit *trimOpt = arg_lit0("z", "trim", "          trim the padding from the bitstreams written");
+	struct arg_str *oldOpt = arg_str0("o", "old", "<f>", "       the flash holds file f, so write only changes");
+	struct arg_str *journalOpt = arg_str0("j", "journal", "<f>", "   keep a journal of the write's progress in file f");
+	struct arg_lit *resumeOpt = arg_lit0("u", "resume", "        resume the interrupted write in the journal");
 	struct arg_lit *helpOpt  = arg_lit0("h", "help", "          print this help and exit\n");
 	struct arg_end *endOpt   = arg_end(20);
-	void *argTable[] = {devOpt, writeOpt, readOpt, swapOpt, helpOpt, endOpt};
+	void *argTable[] = {devOpt, writeOpt, readOpt, hashOpt, swapOpt, verifyOpt, cacheOpt, shadowOpt, manifestOpt, planOpt, sampleOpt, escalateOpt, trimOpt, oldOpt, journalOpt, resumeOpt, helpOpt, endOpt};
 	const char *const progName = "gordon";
 	try {
 		int numErrors;
@@ -67,11 +87,32 @@ int main(int argc, char *argv[]) {
 		transport = new TransportPCIE(devNode);
 		Janitor<Transport> txJan(transport);
 
+		// Detect the flash chip once, for all the reads and writes which follow.
+		if ( shadowOpt->count && !cacheOpt->count ) {
+			throw GordonException("If you specify -k then -c is required");
+		}
+		FlashDevice *device = NULL;
+		if ( readOpt->count || hashOpt->count || writeOpt->count ) {
+			device = new FlashDevice(transport, cacheOpt->count ? cacheOpt->sval[0] : NULL);
+			printf("Device: %s %s\n", device->chip()->vendorName, device->chip()->deviceName);
+			if ( shadowOpt->count && !device->useShadow() ) {
+				printf("The chip has no unique ID, so it cannot have a shadow image\n");
+			}
+		}
+		Janitor<FlashDevice> devJan(device);
+		if ( device && manifestOpt->count ) {
+			const char *ptr;
+			const uint64 address = parseUInt64(manifestOpt->sval[0], &ptr);
+			if ( *ptr != '\0' ) {
+				throw GordonException("Invalid argument to option -m|--manifest=<a>.");
+			}
+			if ( !device->useManifest(address) ) {
+				printf("No manifest at 0x%08llX yet; the next write will create one\n", (unsigned long long)address);
+			}
+		}
+
 		// Read from flash.
 		if ( readOpt->count ) {
-			const FlashChip *const flashChip = findChip(transport);
-			RegionProgrammer prog(transport, flashChip);
-			printf("Device: %s %s\n", flashChip->vendorName, flashChip->deviceName);
 			const char *opt = readOpt->sval[0], *ptr = opt;
 			char ch = *ptr;
 			while ( ch && ch != ':' ) {
@@ -82,58 +123,171 @@ int main(int argc, char *argv[]) {
 			}
 			string fileName(opt, ptr-opt);
 			ptr++;
-			uint32 address = (uint32)strtoul(ptr, (char**)&ptr, 0);
+			const uint64 address = parseUInt64(ptr, &ptr);
 			if ( *ptr != ':' ) {
 				throw GordonException("Invalid argument to option -r|--read=<binFile:address:length>.");
 			}
 			ptr++;
-			uint32 length = (uint32)strtoul(ptr, NULL, 0);
-			uint8 *buffer = new uint8[length];
+			const uint64 length = parseUInt64(ptr, &ptr);
+			if ( *ptr != '\0' ) {
+				throw GordonException("Invalid argument to option -r|--read=<binFile:address:length>.");
+			}
+			if ( length != (size_t)length ) {
+				throw GordonException("Requested read length is too big for this host.");
+			}
+			uint8 *buffer = new uint8[(size_t)length];
 			ArrayJanitor<uint8> bufJan(buffer);
-			prog.read(address, length, buffer);
+			device->read(address, length, buffer);
 			if ( swapOpt->count ) {
-				bitSwap(length, buffer);
+				bitSwap((size_t)length, buffer);
 			}
 			FILE *file = fopen(fileName.c_str(), "wb");
 			if ( !file ) {
 				throw GordonException("Unable to open file for writing.");
 			}
-			if ( length != (uint32)fwrite(buffer, 1, length, file) ) {
+			if ( (size_t)length != fwrite(buffer, 1, (size_t)length, file) ) {
 				throw GordonException("Unable to write entire buffer to file.");
 			}
 			fclose(file);
 		}
 
-		// Write to flash.
-		if ( writeOpt->count ) {
-			const FlashChip *const flashChip = findChip(transport);
-			RegionProgrammer prog(transport, flashChip);
-			printf("Device: %s %s\n", flashChip->vendorName, flashChip->deviceName);
-			const char *opt = writeOpt->sval[0], *ptr = opt;
-			char ch = *ptr;
-			while ( ch && ch != ':' ) {
-				ch = *++ptr;
-			}
-			if ( ch != ':' ) {
-				throw GordonException("Invalid argument to option -w|--write=<f:a>.");
+		// Checksum the flash contents.
+		if ( hashOpt->count ) {
+			const char *ptr = hashOpt->sval[0];
+			const uint64 address = parseUInt64(ptr, &ptr);
+			if ( *ptr != ':' ) {
+				throw GordonException("Invalid argument to option -x|--hash=<address:length>.");
 			}
-			string fileName(opt, ptr-opt);
 			ptr++;
-			uint32 address = (uint32)strtoul(ptr, (char**)&ptr, 0);
+			const uint64 length = parseUInt64(ptr, &ptr);
 			if ( *ptr != '\0' ) {
-				throw GordonException("Invalid argument to option -w|--write=<f:a>.");
+				throw GordonException("Invalid argument to option -x|--hash=<address:length>.");
 			}
-			ptr++;
-			size_t length;
-			uint8 *file = loadFile(fileName.c_str(), &length);
-			if ( !file ) {
-				throw GordonException("Unable to read from file.");
+			vector<RegionDigest> regions;
+			uint8 sha256[SHA256_LENGTH];
+			uint32 crc, i;
+			device->digest(address, length, regions, &crc, sha256);
+			for ( vector<RegionDigest>::const_iterator it = regions.begin(); it != regions.end(); ++it ) {
+				printf(
+					"  0x%08llX-0x%08llX: 0x%08X\n",
+					(unsigned long long)it->address, (unsigned long long)(it->address + it->length - 1), it->crc
+				);
 			}
-			if ( swapOpt->count ) {
-				bitSwap((uint32)length, file);
+			printf("CRC-32C: 0x%08X\nSHA-256: ", crc);
+			for ( i = 0; i < SHA256_LENGTH; i++ ) {
+				printf("%02X", sha256[i]);
+			}
+			printf("\n");
+		}
+
+		// Write to flash. A lone file is written whilst it loads; otherwise the files
+		// given are merged, and written as one image.
+		if ( writeOpt->count ) {
+			const bool streamed = (writeOpt->count == 1 && !trimOpt->count && !planOpt->count);
+			CompositeImage image(device->chip());
+			string streamName;
+			uint64 address = 0;
+			int i;
+			if ( oldOpt->count && writeOpt->count > 1 ) {
+				throw GordonException("If you specify -o then -w may only be given once");
+			}
+			for ( i = 0; i < writeOpt->count; i++ ) {
+				const char *opt = writeOpt->sval[i], *ptr = opt;
+				char ch = *ptr;
+				while ( ch && ch != ':' ) {
+					ch = *++ptr;
+				}
+				if ( ch != ':' ) {
+					throw GordonException("Invalid argument to option -w|--write=<f:a>.");
+				}
+				string fileName(opt, ptr-opt);
+				ptr++;
+				address = parseUInt64(ptr, &ptr);
+				if ( *ptr != '\0' ) {
+					throw GordonException("Invalid argument to option -w|--write=<f:a>.");
+				}
+				if ( streamed ) {
+					streamName = fileName;
+					continue;
+				}
+				size_t length;
+				uint8 *const file = loadFile(fileName.c_str(), &length);
+				if ( !file ) {
+					throw GordonException("Unable to read from file.");
+				}
+				AllocJanitor fileJan(file);
+				if ( swapOpt->count ) {
+					bitSwap(length, file);
+				}
+				if ( trimOpt->count ) {
+					const uint64 trimmed = bitstreamLength(file, length);
+					if ( trimmed < length ) {
+						const uint64 numSkipped = image.numRegions(address, length) - image.numRegions(address, trimmed);
+						printf(
+							"Trimmed 0x%08llX bytes of padding from %s, skipping %u region%s\n",
+							(unsigned long long)(length - trimmed), fileName.c_str(),
+							(uint32)numSkipped, (numSkipped == 1) ? "" : "s"
+						);
+						length = (size_t)trimmed;
+					}
+				}
+				image.add(fileName.c_str(), address, file, length);
+			}
+			FileLoader *const loader = streamed ? new FileLoader(streamName.c_str(), swapOpt->count != 0) : NULL;
+			Janitor<FileLoader> loaderJan(loader);
+			const vector<ImageRun> &runs = image.runs();
+			if ( writeOpt->count > 1 ) {
+				printf(
+					"Writing %d files as %u run%s\n",
+					writeOpt->count, (uint32)runs.size(), (runs.size() == 1) ? "" : "s"
+				);
+			}
+			if ( oldOpt->count ) {
+				size_t oldLength;
+				uint8 *oldFile = loadFile(oldOpt->sval[0], &oldLength);
+				if ( !oldFile ) {
+					throw GordonException("Unable to read from old file.");
+				}
+				AllocJanitor oldJan(oldFile);
+				if ( swapOpt->count ) {
+					bitSwap(oldLength, oldFile);
+				}
+				if ( !device->usePrevious(address, oldLength, oldFile) ) {
+					printf("The flash does not hold the old file; writing in full\n");
+				}
+			}
+			if ( journalOpt->count ) {
+				device->useJournal(journalOpt->sval[0], resumeOpt->count != 0);
+			} else if ( resumeOpt->count ) {
+				throw GordonException("If you specify -u then -j is required");
+			}
+			device->setVerify(verifyOpt->count != 0);
+			if ( planOpt->count ) {
+				WritePlan plan;
+				device->plan(image, plan);
+				printWritePlan(plan);
+			} else {
+				if ( loader ) {
+					device->write(address, *loader);
+				} else {
+					device->write(image);
+				}
+				if ( sampleOpt->count ) {
+					if ( sampleOpt->ival[0] < 0 ) {
+						throw GordonException("Invalid argument to option -n|--sample=<n>.");
+					}
+					if ( loader ) {
+						device->sampledVerify(
+							address, loader->length(), loader->data(), (uint32)sampleOpt->ival[0], escalateOpt->count != 0
+						);
+					}
+					for ( vector<ImageRun>::const_iterator it = runs.begin(); it != runs.end(); ++it ) {
+						device->sampledVerify(
+							it->address, it->length, it->data, (uint32)sampleOpt->ival[0], escalateOpt->count != 0
+						);
+					}
+				}
 			}
-			AllocJanitor fileJan(file);
-			prog.write(address, (uint32)length, file);
 		}
 	}
 	catch ( const GordonException &ex ) {
@@ -16,6 +16,7 @@
  */
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <makestuff.h>
 #include <argtable2.h>
 #include "exception.h"
@@ -23,12 +24,23 @@
 #include "transport_indirect.h"
 #include "transport_iceblink.h"
 #include "flash_chips.h"
+#include "flash_device.h"
 #include "region_programmer.h"
+#include "hash.h"
+#include "write_planner.h"
+#include "composite_image.h"
+#include "bitstream.h"
+#include "file_loader.h"
+#include "shared_transport.h"
+#include "parallel_write.h"
 #include "janitors.h"
 #include "util.h"
 
 using namespace std;
 
+#define MAX_WRITES 16
+#define MAX_CHIPSELECTS 2
+
 class FLContextJanitor {
 	FLContext *const m_ptr;
 	FLContextJanitor &operator=(const FLContextJanitor &other);
@@ -42,20 +54,31 @@ int main(int argc, char *argv[]) {
 	int retVal = 0;
 	struct arg_str *vpOpt = arg_str1("v", "vp", "<VID:PID[:DID]>", " VID, PID and opt. dev ID (e.g 1D50:602B:0001)");
 	struct arg_str *txOpt = arg_str0("t", "transport", "<spec>", "   specify the flash communication mechanism");
-	struct arg_str *writeOpt = arg_str0("w", "write", "<f:a>", "        write file f to address a");
+	struct arg_str *writeOpt = arg_strn("w", "write", "<f:a>", 0, MAX_WRITES, "        write file f to address a (repeatable)");
 	struct arg_str *readOpt = arg_str0("r", "read", "<f:a:l>", "       read l bytes into file f from address a");
+	struct arg_str *hashOpt = arg_str0("x", "hash", "<a:l>", "         print checksums of l bytes from address a");
 	struct arg_lit *swapOpt = arg_lit0("s", "swap", "               bit-swap the flash data read or written");
+	struct arg_lit *verifyOpt = arg_lit0("y", "verify", "             verify the flash data as it is written");
+	struct arg_str *cacheOpt = arg_str0("c", "cache", "<file>", "       remember the chip in a cache file");
+	struct arg_lit *shadowOpt = arg_lit0("k", "shadow", "             keep a shadow copy of the chip beside the cache file");
+	struct arg_str *manifestOpt = arg_str0("m", "manifest", "<a>", "       keep a block-hash manifest at address a");
+	struct arg_lit *planOpt = arg_lit0("p", "plan", "               show what writing would do, without writing");
+	struct arg_int *sampleOpt = arg_int0("n", "sample", "<n>", "         verify sampled pages, n of them at random");
+	struct arg_lit *escalateOpt = arg_lit0("e", "escalate", "           fully check regions failing a sampled verify");
+	struct arg_lit *trimOpt = arg_lit0("z", "trim", "               trim the padding from the bitstreams written");
+	struct arg_str *oldOpt = arg_str0("o", "old", "<f>", "            the flash holds file f, so write only changes");
+	struct arg_str *journalOpt = arg_str0("j", "journal", "<f>", "        keep a journal of the write's progress in file f");
+	struct arg_lit *resumeOpt = arg_lit0("u", "resume", "             resume the interrupted write in the journal");
 	struct arg_lit *bootOpt = arg_lit0("b", "boot", "               start the AVR bootloader");
 	struct arg_lit *helpOpt  = arg_lit0("h", "help", "               print this help and exit\n");
 	struct arg_end *endOpt   = arg_end(20);
-	void *argTable[] = {vpOpt, txOpt, writeOpt, readOpt, swapOpt, bootOpt, helpOpt, endOpt};
+	void *argTable[] = {vpOpt, txOpt, writeOpt, readOpt, hashOpt, swapOpt, verifyOpt, cacheOpt, shadowOpt, manifestOpt, planOpt, sampleOpt, escalateOpt, trimOpt, oldOpt, journalOpt, resumeOpt, bootOpt, helpOpt, endOpt};
 	const char *const progName = "gordon";
 	try {
 		int numErrors;
 		FLStatus fStatus;
 		const char *error = NULL;
 		const char *vp = NULL;
-		Transport *transport = NULL;
 		struct FLContext *handle = NULL;
 
 		if ( arg_nullcheck(argTable) != 0 ) {
@@ -85,29 +108,89 @@ int main(int argc, char *argv[]) {
 		TransportUSB::checkThrow(fStatus, error);
 		FLContextJanitor cxtJan(handle);
 
-		// If reading or writing a flash chip, a transport spec must be supplied.
-		if ( readOpt->count || writeOpt->count ) {
+		// If reading or writing a flash chip, a transport spec must be supplied. An
+		// indirect spec may list several chip-selects (e.g "indirect:1:0,1"), whose
+		// chips are then written at the same time, taking turns on the conduit.
+		TurnLock conduitLock;
+		vector<Transport *> transports;
+		VectorJanitor<Transport> txJan(transports);
+		vector<const Transport *> chipTransports;
+		if ( readOpt->count || hashOpt->count || writeOpt->count ) {
 			if ( txOpt->count == 0 ) {
-				throw GordonException("If you specify -r or -w then -t is required");
+				throw GordonException("If you specify -r, -x or -w then -t is required");
 			}
 			const char *txSpec = txOpt->sval[0];
+			transports.reserve(2 * MAX_CHIPSELECTS);
 			if ( startsWith(txSpec, "direct:") ) {
-				transport = new TransportDirect(handle, txSpec + 7);
+				transports.push_back(new TransportDirect(handle, txSpec + 7));
 			} else if ( startsWith(txSpec, "indirect:") ) {
-				transport = new TransportIndirect(handle, txSpec + 9);
+				const char *ptr = strchr(txSpec + 9, ':');
+				if ( !ptr ) {
+					transports.push_back(new TransportIndirect(handle, txSpec + 9));
+				} else {
+					uint32 seen = 0;
+					do {
+						const uint64 chipSelect = parseUInt64(ptr + 1, &ptr);
+						if ( chipSelect >= MAX_CHIPSELECTS || (seen & (1U << chipSelect)) ) {
+							throw GordonException("Invalid argument to option -t|--transport=<spec>.");
+						}
+						seen |= 1U << chipSelect;
+						transports.push_back(new TransportIndirect(handle, txSpec + 9, (uint32)chipSelect));
+					} while ( *ptr == ',' );
+					if ( *ptr != '\0' ) {
+						throw GordonException("Invalid argument to option -t|--transport=<spec>.");
+					}
+				}
 			} else if ( startsWith(txSpec, "iceblink") ) {
-				transport = new TransportIceBlink(handle);
+				transports.push_back(new TransportIceBlink(handle));
 			} else {
 				throw GordonException("Invalid argument to option -t|--transport=<spec>.");
 			}
+			if ( transports.size() > 1 ) {
+				const size_t numChips = transports.size();
+				size_t i;
+				if ( readOpt->count || hashOpt->count || planOpt->count || journalOpt->count ) {
+					throw GordonException("If you specify several chip-selects then -r, -x, -p and -j are not allowed");
+				}
+				for ( i = 0; i < numChips; i++ ) {
+					transports.push_back(new SharedTransport(transports[i], &conduitLock));
+					chipTransports.push_back(transports.back());
+				}
+			} else {
+				chipTransports.push_back(transports[0]);
+			}
+		}
+
+		// Detect the flash chips once, for all the reads and writes which follow.
+		if ( shadowOpt->count && !cacheOpt->count ) {
+			throw GordonException("If you specify -k then -c is required");
+		}
+		vector<FlashDevice *> devices;
+		VectorJanitor<FlashDevice> devJan(devices);
+		for ( vector<const Transport *>::const_iterator it = chipTransports.begin(); it != chipTransports.end(); ++it ) {
+			devices.push_back(NULL);
+			devices.back() = new FlashDevice(*it, cacheOpt->count ? cacheOpt->sval[0] : NULL);
+			printf("Device: %s %s\n", devices.back()->chip()->vendorName, devices.back()->chip()->deviceName);
+			if ( shadowOpt->count && !devices.back()->useShadow() ) {
+				printf("The chip has no unique ID, so it cannot have a shadow image\n");
+			}
+		}
+		FlashDevice *const device = devices.empty() ? NULL : devices[0];
+		if ( device && manifestOpt->count ) {
+			const char *ptr;
+			const uint64 address = parseUInt64(manifestOpt->sval[0], &ptr);
+			if ( *ptr != '\0' ) {
+				throw GordonException("Invalid argument to option -m|--manifest=<a>.");
+			}
+			for ( vector<FlashDevice *>::const_iterator it = devices.begin(); it != devices.end(); ++it ) {
+				if ( !(*it)->useManifest(address) ) {
+					printf("No manifest at 0x%08llX yet; the next write will create one\n", (unsigned long long)address);
+				}
+			}
 		}
-		Janitor<Transport> txJan(transport);
 
 		// Read from flash.
 		if ( readOpt->count ) {
-			const FlashChip *const flashChip = findChip(transport);
-			RegionProgrammer prog(transport, flashChip);
-			printf("Device: %s %s\n", flashChip->vendorName, flashChip->deviceName);
 			const char *opt = readOpt->sval[0], *ptr = opt;
 			char ch = *ptr;
 			while ( ch && ch != ':' ) {
@@ -118,58 +201,179 @@ int main(int argc, char *argv[]) {
 			}
 			string fileName(opt, ptr-opt);
 			ptr++;
-			uint32 address = (uint32)strtoul(ptr, (char**)&ptr, 0);
+			const uint64 address = parseUInt64(ptr, &ptr);
 			if ( *ptr != ':' ) {
 				throw GordonException("Invalid argument to option -r|--read=<binFile:address:length>.");
 			}
 			ptr++;
-			uint32 length = (uint32)strtoul(ptr, NULL, 0);
-			uint8 *buffer = new uint8[length];
+			const uint64 length = parseUInt64(ptr, &ptr);
+			if ( *ptr != '\0' ) {
+				throw GordonException("Invalid argument to option -r|--read=<binFile:address:length>.");
+			}
+			if ( length != (size_t)length ) {
+				throw GordonException("Requested read length is too big for this host.");
+			}
+			uint8 *buffer = new uint8[(size_t)length];
 			ArrayJanitor<uint8> bufJan(buffer);
-			prog.read(address, length, buffer);
+			device->read(address, length, buffer);
 			if ( swapOpt->count ) {
-				spiBitSwap(length, buffer);
+				bitSwap((size_t)length, buffer);
 			}
 			FILE *file = fopen(fileName.c_str(), "wb");
 			if ( !file ) {
 				throw GordonException("Unable to open file for writing.");
 			}
-			if ( length != (uint32)fwrite(buffer, 1, length, file) ) {
+			if ( (size_t)length != fwrite(buffer, 1, (size_t)length, file) ) {
 				throw GordonException("Unable to write entire buffer to file.");
 			}
 			fclose(file);
 		}
 
-		// Write to flash.
-		if ( writeOpt->count ) {
-			const FlashChip *const flashChip = findChip(transport);
-			RegionProgrammer prog(transport, flashChip);
-			printf("Device: %s %s\n", flashChip->vendorName, flashChip->deviceName);
-			const char *opt = writeOpt->sval[0], *ptr = opt;
-			char ch = *ptr;
-			while ( ch && ch != ':' ) {
-				ch = *++ptr;
-			}
-			if ( ch != ':' ) {
-				throw GordonException("Invalid argument to option -w|--write=<f:a>.");
+		// Checksum the flash contents.
+		if ( hashOpt->count ) {
+			const char *ptr = hashOpt->sval[0];
+			const uint64 address = parseUInt64(ptr, &ptr);
+			if ( *ptr != ':' ) {
+				throw GordonException("Invalid argument to option -x|--hash=<address:length>.");
 			}
-			string fileName(opt, ptr-opt);
 			ptr++;
-			uint32 address = (uint32)strtoul(ptr, (char**)&ptr, 0);
+			const uint64 length = parseUInt64(ptr, &ptr);
 			if ( *ptr != '\0' ) {
-				throw GordonException("Invalid argument to option -w|--write=<f:a>.");
+				throw GordonException("Invalid argument to option -x|--hash=<address:length>.");
 			}
-			ptr++;
-			size_t length;
-			uint8 *file = loadFile(fileName.c_str(), &length);
-			if ( !file ) {
-				throw GordonException("Unable to read from file.");
+			vector<RegionDigest> regions;
+			uint8 sha256[SHA256_LENGTH];
+			uint32 crc, i;
+			device->digest(address, length, regions, &crc, sha256);
+			for ( vector<RegionDigest>::const_iterator it = regions.begin(); it != regions.end(); ++it ) {
+				printf(
+					"  0x%08llX-0x%08llX: 0x%08X\n",
+					(unsigned long long)it->address, (unsigned long long)(it->address + it->length - 1), it->crc
+				);
 			}
-			if ( swapOpt->count ) {
-				spiBitSwap((uint32)length, file);
+			printf("CRC-32C: 0x%08X\nSHA-256: ", crc);
+			for ( i = 0; i < SHA256_LENGTH; i++ ) {
+				printf("%02X", sha256[i]);
+			}
+			printf("\n");
+		}
+
+		// Write to flash. A lone file is written whilst it loads; otherwise the files
+		// given are merged, and written as one image.
+		if ( writeOpt->count ) {
+			const bool streamed = (writeOpt->count == 1 && devices.size() == 1 && !trimOpt->count && !planOpt->count);
+			CompositeImage image(device->chip());
+			string streamName;
+			uint64 address = 0;
+			int i;
+			if ( oldOpt->count && writeOpt->count > 1 ) {
+				throw GordonException("If you specify -o then -w may only be given once");
+			}
+			for ( i = 0; i < writeOpt->count; i++ ) {
+				const char *opt = writeOpt->sval[i], *ptr = opt;
+				char ch = *ptr;
+				while ( ch && ch != ':' ) {
+					ch = *++ptr;
+				}
+				if ( ch != ':' ) {
+					throw GordonException("Invalid argument to option -w|--write=<f:a>.");
+				}
+				string fileName(opt, ptr-opt);
+				ptr++;
+				address = parseUInt64(ptr, &ptr);
+				if ( *ptr != '\0' ) {
+					throw GordonException("Invalid argument to option -w|--write=<f:a>.");
+				}
+				if ( streamed ) {
+					streamName = fileName;
+					continue;
+				}
+				size_t length;
+				uint8 *const file = loadFile(fileName.c_str(), &length);
+				if ( !file ) {
+					throw GordonException("Unable to read from file.");
+				}
+				AllocJanitor fileJan(file);
+				if ( swapOpt->count ) {
+					bitSwap(length, file);
+				}
+				if ( trimOpt->count ) {
+					const uint64 trimmed = bitstreamLength(file, length);
+					if ( trimmed < length ) {
+						const uint64 numSkipped = image.numRegions(address, length) - image.numRegions(address, trimmed);
+						printf(
+							"Trimmed 0x%08llX bytes of padding from %s, skipping %u region%s\n",
+							(unsigned long long)(length - trimmed), fileName.c_str(),
+							(uint32)numSkipped, (numSkipped == 1) ? "" : "s"
+						);
+						length = (size_t)trimmed;
+					}
+				}
+				image.add(fileName.c_str(), address, file, length);
+			}
+			FileLoader *const loader = streamed ? new FileLoader(streamName.c_str(), swapOpt->count != 0) : NULL;
+			Janitor<FileLoader> loaderJan(loader);
+			const vector<ImageRun> &runs = image.runs();
+			if ( writeOpt->count > 1 ) {
+				printf(
+					"Writing %d files as %u run%s\n",
+					writeOpt->count, (uint32)runs.size(), (runs.size() == 1) ? "" : "s"
+				);
+			}
+			if ( oldOpt->count ) {
+				size_t oldLength;
+				uint8 *oldFile = loadFile(oldOpt->sval[0], &oldLength);
+				if ( !oldFile ) {
+					throw GordonException("Unable to read from old file.");
+				}
+				AllocJanitor oldJan(oldFile);
+				if ( swapOpt->count ) {
+					bitSwap(oldLength, oldFile);
+				}
+				for ( vector<FlashDevice *>::const_iterator it = devices.begin(); it != devices.end(); ++it ) {
+					if ( !(*it)->usePrevious(address, oldLength, oldFile) ) {
+						printf("The flash does not hold the old file; writing in full\n");
+					}
+				}
+			}
+			if ( journalOpt->count ) {
+				device->useJournal(journalOpt->sval[0], resumeOpt->count != 0);
+			} else if ( resumeOpt->count ) {
+				throw GordonException("If you specify -u then -j is required");
+			}
+			for ( vector<FlashDevice *>::const_iterator it = devices.begin(); it != devices.end(); ++it ) {
+				(*it)->setVerify(verifyOpt->count != 0);
+			}
+			if ( planOpt->count ) {
+				WritePlan plan;
+				device->plan(image, plan);
+				printWritePlan(plan);
+			} else {
+				if ( loader ) {
+					device->write(address, *loader);
+				} else if ( devices.size() > 1 ) {
+					parallelWrite(devices, image);
+				} else {
+					device->write(image);
+				}
+				if ( sampleOpt->count ) {
+					if ( sampleOpt->ival[0] < 0 ) {
+						throw GordonException("Invalid argument to option -n|--sample=<n>.");
+					}
+					if ( loader ) {
+						device->sampledVerify(
+							address, loader->length(), loader->data(), (uint32)sampleOpt->ival[0], escalateOpt->count != 0
+						);
+					}
+					for ( vector<FlashDevice *>::const_iterator dev = devices.begin(); dev != devices.end(); ++dev ) {
+						for ( vector<ImageRun>::const_iterator it = runs.begin(); it != runs.end(); ++it ) {
+							(*dev)->sampledVerify(
+								it->address, it->length, it->data, (uint32)sampleOpt->ival[0], escalateOpt->count != 0
+							);
+						}
+					}
+				}
 			}
-			AllocJanitor fileJan(file);
-			prog.write(address, (uint32)length, file);
 		}
 
 		// Put an FPGALink/AVR device in DFU mode ready for updating its firmware.
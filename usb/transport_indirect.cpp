@@ -19,12 +19,23 @@
 #include "exception.h"
 #include "transport_indirect.h"
 
-const uint8 TransportIndirect::selectSuppress = (bmTURBO | bmSUPPRESS | bmFLASHCS);  // 0x07
-const uint8 TransportIndirect::selectNoSuppress = (bmTURBO | bmFLASHCS);             // 0x05
 const uint8 TransportIndirect::deSelect = bmTURBO;
 
-TransportIndirect::TransportIndirect(FLContext *handle, const char *conduitStr) :
-	TransportUSB(handle)
+uint8 TransportIndirect::csMask(uint32 chipSelect) {
+	switch ( chipSelect ) {
+	case 0:
+		return bmFLASHCS;
+	case 1:
+		return bmSDCARDCS;
+	default:
+		throw GordonException("TransportIndirect::TransportIndirect(): Illegal chip-select");
+	}
+}
+
+TransportIndirect::TransportIndirect(FLContext *handle, const char *conduitStr, uint32 chipSelect) :
+	TransportUSB(handle),
+	m_selectSuppress((uint8)(bmTURBO | bmSUPPRESS | csMask(chipSelect))),  // 0x07 for the flash CS
+	m_selectNoSuppress((uint8)(bmTURBO | csMask(chipSelect)))              // 0x05 for the flash CS
 {
 	const uint8 conduitNum = (uint8)strtoul(conduitStr, NULL, 10);
 	if ( !conduitNum ) {
@@ -40,12 +51,12 @@ void TransportIndirect::sendMessage(
 	uint8 *recvBuf, uint32 recvLength) const
 {
 	const char *error = 0;
-	FLStatus fStatus = flWriteChannel(m_handle, 1, 1, &selectSuppress, &error);
+	FLStatus fStatus = flWriteChannel(m_handle, 1, 1, &m_selectSuppress, &error);
 	checkThrow(fStatus, error);
 	fStatus = flWriteChannel(m_handle, 0, cmdLength, cmdData, &error);
 	checkThrow(fStatus, error);
 	if ( recvLength ) {
-		fStatus = flWriteChannel(m_handle, 1, 1, &selectNoSuppress, &error);
+		fStatus = flWriteChannel(m_handle, 1, 1, &m_selectNoSuppress, &error);
 		checkThrow(fStatus, error);
 		while ( recvLength > 1024 ) {
 			fStatus = flWriteChannel(m_handle, 0, 1024, recvBuf, &error);
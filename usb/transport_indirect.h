@@ -22,8 +22,10 @@
 // Transport implementation using an indirect (host->micro->FPGA->flash) link.
 // This requires that the FPGA has been programmed with the "spi-talk" design,
 // which provides an indirect interface to the SPI flash via the FPGA, using
-// a regular FPGALink CommFPGA conduit. It assumes the flash to be accessed is
-// on the first of potentially many CS lines from the FPGA.
+// a regular FPGALink CommFPGA conduit. The flash to be accessed may be on either
+// of the FPGA's CS lines: chip-select zero (the default) is the flash CS, and
+// chip-select one is the CS otherwise used for an SD card. Several instances
+// may share a conduit, one for each chip-select.
 //
 class TransportIndirect : public TransportUSB {
 	enum {
@@ -32,11 +34,12 @@ class TransportIndirect : public TransportUSB {
 		bmFLASHCS  = (1<<2),
 		bmSDCARDCS = (1<<3)
 	};
-	static const uint8 selectSuppress;
-	static const uint8 selectNoSuppress;
+	const uint8 m_selectSuppress;
+	const uint8 m_selectNoSuppress;
 	static const uint8 deSelect;
+	static uint8 csMask(uint32 chipSelect);
 public:
-	TransportIndirect(FLContext *handle, const char *conduit);
+	TransportIndirect(FLContext *handle, const char *conduit, uint32 chipSelect = 0);
 	void sendMessage(
 		const uint8 *cmdData, uint32 cmdLength = 1,
 		uint8 *recvBuf = 0, uint32 recvLength = 0